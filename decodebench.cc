@@ -0,0 +1,158 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include "serial/cbor.h"
+#include "serial/json.h"
+#include "serial/msgpack.h"
+
+// Decodes one document as JSON, CBOR and MessagePack, from memory and
+// through read_file(): mapped, which the binary readers decode in place,
+// and streamed, which they collect first.  The binary encodings are made
+// from the JSON file and written next to it in the temporary directory.
+namespace {
+
+template <typename F>
+double best_time(unsigned iterations, F && f)
+{
+	double best = 1e9;
+
+	for (unsigned round = 0; round < 5; ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned i = 0; i < iterations; ++i)
+			f();
+
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+
+		best = std::min(best, elapsed.count() / iterations);
+	}
+
+	return best;
+}
+
+// Returns the time to decode from memory; percentages are against
+// baseline, or against that time if baseline is 0.
+template <typename Reader, typename Options>
+double compare(const char * name, const std::string & document,
+               const serial::stdfs::path & filename, unsigned iterations,
+               double baseline)
+{
+	serial::null_visitor data;
+	Options mapped, streamed;
+	mapped.input.strategy = serial::read_strategy::mmap_populate;
+	streamed.input.strategy = serial::read_strategy::stream;
+
+	// Each reader is reused, so collected input is only copied, not
+	// reallocated, and the times don't depend on the allocator's state
+	Reader in_memory, from_mapping(mapped), from_stream(streamed);
+
+	double memory = best_time(iterations, [&]{
+		in_memory.parse(document.data(), document.size(), data);
+	});
+	double file = best_time(iterations, [&]{
+		from_mapping.read_file(filename, data);
+	});
+	double stream = best_time(iterations, [&]{
+		from_stream.read_file(filename, data);
+	});
+
+	if (baseline == 0)
+		baseline = memory;
+
+	printf("%-8s %10zu bytes   memory %8.3f ms (%+6.1f%%)   "
+	       "mapped %8.3f ms   streamed %8.3f ms\n",
+	       name, document.size(), memory * 1e3,
+	       (memory - baseline) / baseline * 100, file * 1e3, stream * 1e3);
+
+	return memory;
+}
+
+// The JSON parser with the binary readers' interface, which takes a
+// buffer rather than a string_view
+class json_reader
+{
+ public:
+	json_reader(const serial::json::parse_options & options
+	              = serial::json::parse_options())
+	  : p(options)
+		{ }
+
+	void parse(const char * buffer, size_t n, serial::null_visitor & data)
+		{ p.parse(std::string_view(buffer, n), data); }
+
+	void read_file(const serial::stdfs::path & filename,
+	               serial::null_visitor & data)
+		{ p.read_file(filename, data); }
+
+ private:
+	serial::json::basic_parser<serial::null_visitor> p;
+};
+
+void write_file(const serial::stdfs::path & filename, const std::string & data)
+{
+	std::ofstream out(filename, std::ios::binary);
+	out.write(data.data(), data.size());
+
+	if ( ! out.flush())
+	{
+		fprintf(stderr, "could not write %s\n", filename.c_str());
+		exit(1);
+	}
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file.json [iterations]\n", argv[0]);
+		exit(1);
+	}
+
+	unsigned iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+	std::string json;
+	serial::read_file(argv[1], serial::read_options(),
+		[&](const char * chunk, size_t n, bool) { json.append(chunk, n); });
+
+	serial::value_store tree;
+	serial::json::basic_parser<serial::value_store> p;
+	p.parse(json, tree);
+
+	auto directory = serial::stdfs::temp_directory_path();
+	auto prefix = "decodebench." + std::to_string(getpid());
+	auto json_file = directory / (prefix + ".json");
+	auto cbor_file = directory / (prefix + ".cbor");
+	auto msgpack_file = directory / (prefix + ".msgpack");
+
+	std::string cbor = serial::cbor::encode(tree);
+	std::string msgpack = serial::msgpack::encode(tree);
+
+	write_file(json_file, json);
+	write_file(cbor_file, cbor);
+	write_file(msgpack_file, msgpack);
+
+	double baseline = compare<json_reader, serial::json::parse_options>(
+		"json", json, json_file, iterations, 0);
+	compare<serial::cbor::basic_reader<serial::null_visitor>,
+	        serial::cbor::parse_options>(
+		"cbor", cbor, cbor_file, iterations, baseline);
+	compare<serial::msgpack::basic_reader<serial::null_visitor>,
+	        serial::msgpack::parse_options>(
+		"msgpack", msgpack, msgpack_file, iterations, baseline);
+
+	serial::stdfs::remove(json_file);
+	serial::stdfs::remove(cbor_file);
+	serial::stdfs::remove(msgpack_file);
+
+	return 0;
+}
@@ -1,7 +1,11 @@
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <limits>
 #include <initializer_list>
 #include <random>
+#include <string>
+#include <vector>
 
 #include "util/fp_convert.h"
 
@@ -20,6 +24,104 @@ void stress_test()
 	}
 }
 
+// Metric-like values: a few digits either side of the point
+std::vector<double> sample_values(size_t n)
+{
+	std::mt19937_64 rng(1);
+	std::lognormal_distribution<double> dist(3, 4);
+	std::vector<double> values(n);
+
+	for (auto & v : values)
+		v = rng() % 8 ? dist(rng) : -dist(rng);
+
+	return values;
+}
+
+template <typename F>
+double ns_per_value(const std::vector<double> & values, F format)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	for (double v : values)
+		format(v);
+
+	std::chrono::duration<double, std::nano> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	return elapsed.count() / values.size();
+}
+
+void benchmark()
+{
+	auto values = sample_values(1'000'000);
+	char buffer[util::fp_fixed_length];
+	unsigned mismatches = 0;
+
+	for (double v : values)
+	{
+		char expected[util::fp_fixed_length];
+		snprintf(expected, sizeof expected, "%.3f", v);
+		buffer[util::fp_convert_fixed(v, 3, buffer)] = '\0';
+		mismatches += strcmp(buffer, expected) != 0;
+	}
+
+	printf("\n%u of %zu differ from %%.3f\n\n", mismatches, values.size());
+
+	auto report = [](const char * name, double ours, double theirs)
+	{
+		printf("%-22s %7.1f ns   snprintf %7.1f ns   %.1fx\n",
+		       name, ours, theirs, theirs / ours);
+	};
+
+	report("shortest (%.17g)",
+	       ns_per_value(values, [&](double v) { util::fp_convert(v, buffer); }),
+	       ns_per_value(values, [&](double v) { snprintf(buffer, sizeof buffer, "%.17g", v); }));
+	report("fixed (%.3f)",
+	       ns_per_value(values, [&](double v) { util::fp_convert_fixed(v, 3, buffer); }),
+	       ns_per_value(values, [&](double v) { snprintf(buffer, sizeof buffer, "%.3f", v); }));
+	report("significant (%.6g)",
+	       ns_per_value(values, [&](double v) { util::fp_convert_significant(v, 6, buffer); }),
+	       ns_per_value(values, [&](double v) { snprintf(buffer, sizeof buffer, "%.6g", v); }));
+
+	// One call for the whole array against a call and an append per value
+	std::string out;
+	out.reserve(values.size() * 32);
+
+	auto time_batch = [&]
+	{
+		out.clear();
+		auto start = std::chrono::steady_clock::now();
+		util::fp_convert(values.data(), values.size(), out,
+		                 util::fp_format{util::fp_mode::fixed, 3});
+		return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start);
+	};
+
+	auto time_single = [&]
+	{
+		out.clear();
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t i = 0; i < values.size(); ++i)
+		{
+			if (i)
+				out.push_back(',');
+			out.append(buffer, util::fp_convert_fixed(values[i], 3, buffer));
+		}
+
+		return std::chrono::duration<double, std::nano>(
+			std::chrono::steady_clock::now() - start);
+	};
+
+	// The first pass faults in the string's pages
+	time_batch();
+	auto batch = time_batch();
+	auto single = time_single();
+
+	printf("%-22s %7.1f ns   per call %7.1f ns\n", "batch fixed (%.3f)",
+	       batch.count() / values.size(), single.count() / values.size());
+}
+
 int main()
 {
 	std::initializer_list<double> values = {
@@ -73,6 +175,7 @@ int main()
 	}
 
 	stress_test();
+	benchmark();
 
 	return 0;
 }
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "serial/json.h"
+
+// Parses generated worst-case documents, each about the same size, and
+// reports the slowest run in ns/byte: unlimited into a null_visitor and
+// into a value_store, and with parse_limits::untrusted() into a
+// value_store, which should give up early on most of them.  Unlimited
+// value_store runs are skipped for the deeply nested documents: trees
+// millions of levels deep overflow the stack when they are destroyed,
+// which is what max_depth is there to prevent.
+
+namespace {
+
+struct adversary
+{
+	const char * name;
+	std::function<std::string(size_t)> generate;
+	bool exact_numbers;
+	bool deep;
+};
+
+std::string repeat(const std::string & s, size_t size)
+{
+	std::string out;
+	out.reserve(size + s.size());
+
+	while (out.size() < size)
+		out += s;
+
+	return out;
+}
+
+// Appends rather than inserting in front of inner, as "[" + std::string
+// does, which GCC 12 mistakes for an overlapping copy (-Wrestrict)
+std::string enclose(const char * open, const std::string & inner,
+                    const char * close)
+{
+	std::string out;
+	out.reserve(strlen(open) + inner.size() + strlen(close));
+	out += open;
+	out += inner;
+	out += close;
+	return out;
+}
+
+std::string nested(const char * open, const char * close, size_t n,
+                   const std::string & inner = "0")
+{
+	std::string out;
+	out.reserve(n * (strlen(open) + strlen(close)) + inner.size());
+
+	for (size_t i = 0; i < n; ++i)
+		out += open;
+
+	out += inner;
+
+	for (size_t i = 0; i < n; ++i)
+		out += close;
+
+	return out;
+}
+
+std::string array_of(const std::string & element, size_t size)
+{
+	std::string out = enclose("[", repeat(element + ",", size - 2), "");
+	out.back() = ']';
+	return out;
+}
+
+std::string wide_object(size_t size)
+{
+	std::string out = "{";
+	out.reserve(size + 32);
+
+	for (size_t i = 0; out.size() < size; ++i)
+		out += "\"k" + std::to_string(i) + "\":" + std::to_string(i) + ",";
+
+	out.back() = '}';
+	return out;
+}
+
+std::string long_string(const std::string & unit, size_t size)
+{
+	return enclose("\"", repeat(unit, size - 2), "\"");
+}
+
+const adversary adversaries[] = {
+	{ "deep arrays", [](size_t n) {
+		return nested("[", "]", n / 2); }, false, true },
+	{ "deep objects", [](size_t n) {
+		return nested("{\"a\":", "}", n / 6); }, false, true },
+	// Every leaf of a value_store is found again from the root
+	{ "deep, many leaves", [](size_t n) {
+		return nested("[", "]", 100, array_of("1", n - 200)); }, false, false },
+	{ "wide array", [](size_t n) {
+		return array_of("0", n); }, false, false },
+	{ "empty containers", [](size_t n) {
+		return array_of("[],{}", n); }, false, false },
+	{ "wide object", [](size_t n) {
+		return wide_object(n); }, false, false },
+	{ "long key", [](size_t n) {
+		return enclose("{", long_string("k", n - 5), ":0}"); }, false, false },
+	{ "plain string", [](size_t n) {
+		return long_string("x", n); }, false, false },
+	{ "escapes", [](size_t n) {
+		return long_string("\\n\\\"", n); }, false, false },
+	{ "\\u escapes", [](size_t n) {
+		return long_string("\\u00e9", n); }, false, false },
+	{ "surrogates", [](size_t n) {
+		return long_string("\\ud83d\\ude00", n); }, false, false },
+	{ "utf-8", [](size_t n) {
+		return long_string("\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", n); }, false, false },
+	{ "huge number", [](size_t n) {
+		return enclose("[", repeat("9", n - 2), "]"); }, false, false },
+	{ "huge number, exact", [](size_t n) {
+		return enclose("[", repeat("9", n - 2), "]"); }, true, false },
+	{ "long numbers", [](size_t n) {
+		return array_of("0." + std::string(300, '1') + "e-300", n); }, false, false },
+	{ "long numbers, exact", [](size_t n) {
+		return array_of("0." + std::string(300, '1') + "e-300", n); }, true, false },
+	{ "whitespace", [](size_t n) {
+		return enclose("[", std::string(n - 3, ' '), "0]"); }, false, false },
+};
+
+struct timing
+{
+	double worst = 0;
+	double best = 1e300;
+	std::string outcome = "ok";
+};
+
+template <typename Visitor>
+timing time_parse(const std::string & document, unsigned iterations,
+                  const serial::json::parse_options & options)
+{
+	timing t;
+
+	for (unsigned i = 0; i < iterations; ++i)
+	{
+		Visitor data;
+		serial::json::parser p(options);
+
+		auto start = std::chrono::steady_clock::now();
+
+		try
+		{
+			p.parse(document, data);
+		} catch (const serial::limit_exceeded & e)
+		{
+			t.outcome = serial::to_string(e.which);
+		}
+
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+
+		double ns_per_byte = elapsed.count() * 1e9 / document.size();
+		t.worst = std::max(t.worst, ns_per_byte);
+		t.best = std::min(t.best, ns_per_byte);
+	}
+
+	return t;
+}
+
+} // namespace
+
+int main(int argc, char ** argv)
+{
+	size_t size = (argc > 1 ? atof(argv[1]) : 16) * 1024 * 1024;
+	unsigned iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+	if (size < 1024 || iterations == 0)
+	{
+		fprintf(stderr, "usage: %s [MiB per document] [iterations]\n", argv[0]);
+		exit(1);
+	}
+
+	printf("%-20s %22s %22s %30s\n", "", "null (ns/byte)",
+	       "value_store (ns/byte)", "untrusted limits (ns/byte)");
+	printf("%-20s %10s %11s %10s %11s %10s %19s\n", "input",
+	       "best", "worst", "best", "worst", "worst", "stopped by");
+
+	const char * slowest = nullptr;
+	double slowest_time = 0;
+
+	for (const auto & a : adversaries)
+	{
+		std::string document = a.generate(size);
+
+		serial::json::parse_options options;
+		options.exact_numbers = a.exact_numbers;
+
+		timing null = time_parse<serial::null_visitor>(document, iterations,
+		                                               options);
+		timing store;
+
+		if ( ! a.deep)
+			store = time_parse<serial::value_store>(document, iterations, options);
+
+		options.limits = serial::parse_limits::untrusted();
+		// All the documents are this large; show what else stops them
+		options.limits.max_bytes = 0;
+		timing limited = time_parse<serial::value_store>(document, iterations,
+		                                                 options);
+
+		if (a.deep)
+			printf("%-20s %10.2f %11.2f %10s %11s %10.2f %19s\n", a.name,
+			       null.best, null.worst, "-", "-",
+			       limited.worst, limited.outcome.c_str());
+		else
+			printf("%-20s %10.2f %11.2f %10.2f %11.2f %10.2f %19s\n", a.name,
+			       null.best, null.worst, store.best, store.worst,
+			       limited.worst, limited.outcome.c_str());
+
+		if (store.worst > slowest_time)
+		{
+			slowest = a.name;
+			slowest_time = store.worst;
+		}
+	}
+
+	printf("\nworst case: %s, %.2f ns/byte into a value_store\n",
+	       slowest, slowest_time);
+
+	return 0;
+}
@@ -1,20 +1,198 @@
-#include <chrono>
+#include <unistd.h>
 
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "serial/batch_reader.h"
+#include "serial/flatten.h"
 #include "serial/json.h"
+#include "serial/writer.h"
+#include "util/error_handling.h"
+#include "util/file_descriptor.h"
+
+// Flattens JSON documents to one "<path> -> <value>" line per leaf, for
+// grep and friends, and turns such lines back into JSON.
+
+namespace {
+
+void usage(const char * name)
+{
+	fprintf(stderr,
+		"usage: %s [--filter PATTERN]... [--jobs N] [--exact] [file...]\n"
+		"       %s --unflatten [--pretty] [file]\n"
+		"\n"
+		"Without files, or for a lone \"-\", reads standard input.  With\n"
+		"several files, these are parsed in parallel and each line starts\n"
+		"with the file name and ':'.  --filter keeps only leaves whose path\n"
+		"matches a shell pattern, e.g. '.servers.*.name', where '*' also\n"
+		"matches '.'.\n",
+		name, name);
+	exit(1);
+}
+
+void write_all(int fd, std::string_view data)
+{
+	while ( ! data.empty())
+	{
+		ssize_t n = ::write(fd, data.data(), data.size());
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			util::throw_errno("write");
+		}
+
+		data.remove_prefix(n);
+	}
+}
+
+void flatten(const std::vector<serial::stdfs::path> & files,
+             const serial::flatten_options & options,
+             const serial::json::parse_options & parsing,
+             unsigned jobs)
+{
+	util::file_descriptor out(dup(STDOUT_FILENO));
+
+	if (out < 0)
+		util::throw_errno("dup");
+
+	if (files.size() == 1)
+	{
+		// A parser over the final visitor type, so the callbacks inline
+		serial::flattening_visitor data(
+			[&](std::string_view lines) { write_all(out, lines); }, options);
+		serial::json::basic_parser<serial::flattening_visitor> p(parsing);
+
+		p.read_file(files[0], data);
+		data.flush();
+		return;
+	}
+
+	// The batch reader opens each file by name
+	for (const auto & f : files)
+		if (f == "-")
+			throw std::runtime_error("standard input (\"-\") cannot be read "
+			                         "along with other files");
+
+	std::mutex output_lock;
+	auto output = [&](std::string_view lines) {
+		std::lock_guard<std::mutex> guard(output_lock);
+		write_all(out, lines);
+	};
+
+	// One visitor per worker thread, reused for every file it parses.
+	// Batches from different files interleave, but always as whole lines.
+	std::mutex visitors_lock;
+	std::unordered_map<std::thread::id,
+	                   std::unique_ptr<serial::flattening_visitor>> visitors;
+
+	serial::json::batch_options batch;
+	batch.workers = jobs;
+
+	serial::json::batch_reader reader(batch, parsing);
+
+	reader.read_files(files, [&](size_t index) -> serial::data_visitor & {
+		serial::flattening_visitor * current;
+
+		{
+			std::lock_guard<std::mutex> guard(visitors_lock);
+			auto & v = visitors[std::this_thread::get_id()];
+
+			if ( ! v)
+				v = std::make_unique<serial::flattening_visitor>(output, options);
+
+			current = v.get();
+		}
+
+		// The rest of the previous file this thread parsed
+		current->flush();
+		current->set_prefix(files[index].string() + ':');
+		return *current;
+	});
+
+	for (auto & [thread, v] : visitors)
+		v->flush();
+}
+
+void unflatten(const serial::stdfs::path & file, bool pretty)
+{
+	std::ios::sync_with_stdio(false);
+
+	serial::writer_options options;
+	options.pretty = pretty;
+	options.buffer_size = 1024 * 1024;
+
+	serial::writer w(std::cout, options);
+	serial::writer_visitor data(w);
+	serial::unflattener lines(data);
+
+	serial::read_file(file, serial::read_options(),
+		[&](const char * chunk, size_t n, bool) { lines.add({chunk, n}); });
+
+	lines.finish();
+	data.finish();
+	w.flush();
+	std::cout << '\n';
+}
+
+} // namespace
 
 int main(int argc, char ** argv)
 {
-	if (argc < 2)
+	serial::flatten_options options;
+	serial::json::parse_options parsing;
+	std::vector<serial::stdfs::path> files;
+	unsigned jobs = 0;
+	bool reverse = false;
+	bool pretty = false;
+
+	for (int i = 1; i < argc; ++i)
 	{
-		fprintf(stderr, "Need config file\n");
-		exit(1);
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			options.filters.push_back(argv[++i]);
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+			jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--exact") == 0)
+			parsing.exact_numbers = true;
+		else if (strcmp(argv[i], "--unflatten") == 0)
+			reverse = true;
+		else if (strcmp(argv[i], "--pretty") == 0)
+			pretty = true;
+		else if (argv[i][0] == '-' && argv[i][1] != '\0')
+			usage(argv[0]);
+		else
+			files.push_back(argv[i]);
 	}
 
-	serial::json::parser p;
-//	serial::value_store data;
-	serial::printing_visitor data;
-	p.read_file(argv[1], data);
+	if (files.empty())
+		files.push_back("-");
+
+	try
+	{
+		if (reverse)
+		{
+			if (files.size() != 1)
+				usage(argv[0]);
+
+			unflatten(files[0], pretty);
+		} else
+		{
+			flatten(files, options, parsing, jobs);
+		}
+	} catch (const std::exception & e)
+	{
+		fprintf(stderr, "%s: %s\n", argv[0], e.what());
+		return 1;
+	}
 
-//	data.print(std::cout);
-	std::cout << std::endl;
+	return 0;
 }
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "serial/json.h"
+
+// Parses the same file through the virtual data_visitor interface and
+// through parsers instantiated directly over the (final) visitor types,
+// where the callbacks can be inlined into the state machine.
+template <typename Parser, typename Visitor>
+double time_parse(const char * filename, unsigned iterations,
+                  Visitor & data, uint64_t & bytes)
+{
+	serial::json::parse_options options;
+	options.input.strategy = serial::read_strategy::mmap_populate;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < iterations; ++i)
+	{
+		Parser p(options);
+		p.read_file(filename, data);
+		bytes = p.last_read_stats().data_bytes;
+	}
+
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	return elapsed.count() / iterations;
+}
+
+template <typename Visitor>
+void compare(const char * name, const char * filename, unsigned iterations)
+{
+	using serial::json::parser;
+	using serial::json::basic_parser;
+
+	Visitor virtual_data, static_data;
+	uint64_t bytes = 0;
+
+	double dynamic = time_parse<parser>(filename, iterations,
+	                                    virtual_data, bytes);
+	double fixed = time_parse<basic_parser<Visitor>>(filename, iterations,
+	                                                 static_data, bytes);
+
+	printf("%-10s virtual %8.3f ms (%6.2f ns/byte)   "
+	       "static %8.3f ms (%6.2f ns/byte)   %+.1f%%\n",
+	       name,
+	       dynamic * 1e3, dynamic * 1e9 / bytes,
+	       fixed * 1e3, fixed * 1e9 / bytes,
+	       (dynamic - fixed) / dynamic * 100);
+}
+
+// For small documents such as request bodies, where setting up a parser
+// and growing its buffers again each time is a large part of the cost.
+// Skipped for files over 64 KiB.
+void compare_reuse(const char * filename, unsigned iterations)
+{
+	std::string document;
+	serial::read_file(filename, serial::read_options(),
+		[&](const char * chunk, size_t n, bool) { document.append(chunk, n); });
+
+	if (document.size() > 64 * 1024)
+		return;
+
+	serial::null_visitor data;
+
+	auto time = [&](auto && parse) {
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned i = 0; i < iterations; ++i)
+			parse();
+
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+
+		return elapsed.count() / iterations;
+	};
+
+	// The difference is a few percent, so the two alternate and the best
+	// round of each counts, rather than one warming up for the other
+	double fresh = 1e9;
+	double pooled = 1e9;
+
+	for (unsigned round = 0; round < 5; ++round)
+	{
+		fresh = std::min(fresh, time([&]{
+			serial::json::parser p;
+			p.parse(document, data);
+		}));
+		pooled = std::min(pooled, time([&]{
+			serial::json::parser_pool::parse(document, data);
+		}));
+	}
+
+	printf("%-10s fresh   %8.3f us (%8.0f docs/s)   "
+	       "pooled %8.3f us (%8.0f docs/s)   %+.1f%%\n",
+	       "reuse",
+	       fresh * 1e6, 1 / fresh, pooled * 1e6, 1 / pooled,
+	       (fresh - pooled) / fresh * 100);
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file.json [iterations]\n", argv[0]);
+		exit(1);
+	}
+
+	unsigned iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+	compare<serial::null_visitor>("null", argv[1], iterations);
+	compare<serial::counting_visitor>("counting", argv[1], iterations);
+	compare_reuse(argv[1], iterations * 1000);
+
+	return 0;
+}
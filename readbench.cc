@@ -0,0 +1,58 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+
+#include "serial/json.h"
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s file.json [iterations]\n", argv[0]);
+		exit(1);
+	}
+
+	unsigned iterations = argc > 2 ? atoi(argv[2]) : 10;
+
+	std::initializer_list<serial::read_strategy> strategies = {
+		serial::read_strategy::automatic,
+		serial::read_strategy::read,
+		serial::read_strategy::mmap,
+		serial::read_strategy::mmap_sequential,
+		serial::read_strategy::mmap_populate,
+		serial::read_strategy::huge_page_buffer,
+		serial::read_strategy::stream,
+	};
+
+	for (auto strategy : strategies)
+	{
+		serial::json::parse_options options;
+		options.input.strategy = strategy;
+
+		serial::null_visitor data;
+		serial::read_stats stats;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned i = 0; i < iterations; ++i)
+		{
+			serial::json::parser p(options);
+			p.read_file(argv[1], data);
+			stats = p.last_read_stats();
+		}
+
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+
+		double seconds = elapsed.count() / iterations;
+
+		printf("%-17s -> %-17s %10.3f ms %8.1f MB/s\n",
+		       serial::to_string(strategy),
+		       serial::to_string(stats.strategy),
+		       seconds * 1e3,
+		       stats.data_bytes / seconds / 1e6);
+	}
+
+	return 0;
+}
@@ -0,0 +1,429 @@
+#include "aggregate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "util/cpu_features.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SERIAL_AGGREGATE_AVX2 1
+#endif
+
+namespace serial {
+
+namespace {
+
+template <typename T>
+struct partial
+{
+	using sum_type = std::conditional_t<std::is_floating_point_v<T>, double, __int128>;
+
+	uint64_t count = 0;
+	sum_type sum = 0;
+	T min = 0;
+	T max = 0;
+
+	void add(T x)
+	{
+		if (count == 0 || x < min)
+			min = x;
+		if (count == 0 || x > max)
+			max = x;
+		sum += x;
+		++count;
+	}
+
+	void merge(const partial & other)
+	{
+		if (other.count == 0)
+			return;
+
+		if (count == 0 || other.min < min)
+			min = other.min;
+		if (count == 0 || other.max > max)
+			max = other.max;
+		sum += other.sum;
+		count += other.count;
+	}
+};
+
+// Every row in [0, n) is valid
+template <typename T>
+void dense_scalar(const T * values, size_t n, partial<T> & result)
+{
+	for (size_t i = 0; i < n; ++i)
+		result.add(values[i]);
+}
+
+#ifdef SERIAL_AGGREGATE_AVX2
+// The kernels below are compiled for AVX2 whatever the build flags, and
+// only called when util::simd() says the CPU has it.
+
+// The 64-bit lanes accumulate the low and high 32-bit halves separately,
+// so the sums cannot wrap before 2^32 iterations; runs are cut well below
+// that and recombined in 128 bits.
+static constexpr size_t max_vector_run = size_t(1) << 30;
+
+template <bool is_signed>
+__attribute__((target("avx2")))
+void dense_integers(const uint64_t * values, size_t n,
+                    __int128 & sum, uint64_t & min, uint64_t & max)
+{
+	// Unsigned lanes compare as signed after flipping the sign bit
+	const __m256i flip = _mm256_set1_epi64x(is_signed ? 0 : int64_t(1) << 63);
+	const __m256i low_mask = _mm256_set1_epi64x(0xffffffff);
+	const __m256i zero = _mm256_setzero_si256();
+
+	__m256i lows = zero, highs = zero, negatives = zero;
+	__m256i lowest = _mm256_xor_si256(
+		_mm256_loadu_si256(reinterpret_cast<const __m256i *>(values)), flip);
+	__m256i highest = lowest;
+
+	for (size_t i = 0; i < n; i += 4)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+
+		lows = _mm256_add_epi64(lows, _mm256_and_si256(x, low_mask));
+		highs = _mm256_add_epi64(highs, _mm256_srli_epi64(x, 32));
+		if (is_signed)
+			negatives = _mm256_sub_epi64(negatives, _mm256_cmpgt_epi64(zero, x));
+
+		x = _mm256_xor_si256(x, flip);
+		lowest = _mm256_blendv_epi8(lowest, x, _mm256_cmpgt_epi64(lowest, x));
+		highest = _mm256_blendv_epi8(highest, x, _mm256_cmpgt_epi64(x, highest));
+	}
+
+	alignas(32) uint64_t low_lanes[4], high_lanes[4], negative_lanes[4];
+	alignas(32) int64_t min_lanes[4], max_lanes[4];
+
+	_mm256_store_si256(reinterpret_cast<__m256i *>(low_lanes), lows);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(high_lanes), highs);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(negative_lanes), negatives);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(min_lanes), lowest);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(max_lanes), highest);
+
+	// Sum of the bit patterns as unsigned, less 2^64 per negative value
+	unsigned __int128 total = 0;
+	unsigned __int128 wrap = 0;
+
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		total += (static_cast<unsigned __int128>(high_lanes[lane]) << 32)
+		       + low_lanes[lane];
+		wrap += negative_lanes[lane];
+	}
+
+	sum = static_cast<__int128>(total) - static_cast<__int128>(wrap << 64);
+
+	int64_t low = *std::min_element(min_lanes, min_lanes + 4);
+	int64_t high = *std::max_element(max_lanes, max_lanes + 4);
+	uint64_t unflip = is_signed ? 0 : uint64_t(1) << 63;
+
+	min = uint64_t(low) ^ unflip;
+	max = uint64_t(high) ^ unflip;
+}
+
+template <typename T>
+__attribute__((target("avx2")))
+void dense_integers_avx2(const T * values, size_t n, partial<T> & result)
+{
+	size_t i = 0;
+
+	while (n - i >= 4)
+	{
+		size_t run = std::min((n - i) & ~size_t(3), max_vector_run);
+
+		partial<T> p;
+		uint64_t min, max;
+
+		dense_integers<std::is_signed_v<T>>(
+			reinterpret_cast<const uint64_t *>(values + i), run, p.sum, min, max);
+		p.count = run;
+		p.min = T(min);
+		p.max = T(max);
+
+		result.merge(p);
+		i += run;
+	}
+
+	for (; i < n; ++i)
+		result.add(values[i]);
+}
+
+// Four lanes with two accumulators each; the sum is therefore rounded in a
+// different order than a sequential loop would.
+__attribute__((target("avx2")))
+void dense_doubles_avx2(const double * values, size_t n, partial<double> & result)
+{
+	size_t i = 0;
+
+	if (n >= 8)
+	{
+		__m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+		__m256d lowest = _mm256_loadu_pd(values), highest = lowest;
+
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256d a = _mm256_loadu_pd(values + i);
+			__m256d b = _mm256_loadu_pd(values + i + 4);
+
+			sum0 = _mm256_add_pd(sum0, a);
+			sum1 = _mm256_add_pd(sum1, b);
+			lowest = _mm256_min_pd(lowest, _mm256_min_pd(a, b));
+			highest = _mm256_max_pd(highest, _mm256_max_pd(a, b));
+		}
+
+		alignas(32) double sum_lanes[4], min_lanes[4], max_lanes[4];
+
+		_mm256_store_pd(sum_lanes, _mm256_add_pd(sum0, sum1));
+		_mm256_store_pd(min_lanes, lowest);
+		_mm256_store_pd(max_lanes, highest);
+
+		partial<double> p;
+		p.count = i;
+		p.sum = (sum_lanes[0] + sum_lanes[1]) + (sum_lanes[2] + sum_lanes[3]);
+		p.min = *std::min_element(min_lanes, min_lanes + 4);
+		p.max = *std::max_element(max_lanes, max_lanes + 4);
+
+		result.merge(p);
+	}
+
+	for (; i < n; ++i)
+		result.add(values[i]);
+}
+#endif
+
+template <typename T>
+void dense(const T * values, size_t n, partial<T> & result)
+{
+#ifdef SERIAL_AGGREGATE_AVX2
+	if (util::simd() >= util::simd_level::avx2)
+	{
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			dense_doubles_avx2(values, n, result);
+			return;
+		} else if constexpr (sizeof(T) == sizeof(uint64_t))
+		{
+			dense_integers_avx2(values, n, result);
+			return;
+		}
+	}
+#endif
+
+	dense_scalar(values, n, result);
+}
+
+// Rows [begin, end), with begin a multiple of 64.  Runs of fully valid
+// words go to the dense kernel; the rest are tested bit by bit.
+template <typename T>
+partial<T> reduce(const T * values, const uint64_t * validity,
+                  size_t begin, size_t end)
+{
+	partial<T> result;
+	size_t row = begin;
+
+	while (row < end)
+	{
+		size_t run = row;
+
+		while (run + 64 <= end && validity[run / 64] == ~uint64_t(0))
+			run += 64;
+
+		if (run != row)
+		{
+			dense(values + row, run - row, result);
+			row = run;
+			continue;
+		}
+
+		size_t stop = std::min(row + 64, end);
+		uint64_t word = validity[row / 64];
+
+		for (; row < stop; ++row)
+			if ((word >> (row % 64)) & 1)
+				result.add(values[row]);
+	}
+
+	return result;
+}
+
+template <typename T>
+partial<T> reduce_parallel(const std::vector<T> & values,
+                           const std::vector<uint64_t> & validity,
+                           size_t rows, unsigned threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	threads = std::min<size_t>(threads, std::max<size_t>(1, rows / parallel_rows));
+
+	if (threads <= 1)
+		return reduce(values.data(), validity.data(), 0, rows);
+
+	// Chunks start on a validity word boundary
+	size_t chunk = ((rows + threads - 1) / threads + 63) & ~size_t(63);
+
+	std::vector<partial<T>> partials(threads);
+	std::vector<std::thread> workers;
+
+	for (unsigned t = 1; t < threads; ++t)
+	{
+		size_t begin = std::min(rows, t * chunk);
+		size_t end = std::min(rows, begin + chunk);
+
+		workers.emplace_back([&, t, begin, end] {
+			partials[t] = reduce(values.data(), validity.data(), begin, end);
+		});
+	}
+
+	partials[0] = reduce(values.data(), validity.data(), 0, std::min(rows, chunk));
+
+	for (auto & w : workers)
+		w.join();
+
+	for (unsigned t = 1; t < threads; ++t)
+		partials[0].merge(partials[t]);
+
+	return partials[0];
+}
+
+// The values of an int128 column all lie in [INT64_MIN, UINT64_MAX]
+number exact_number(__int128 x)
+{
+	if (x <= std::numeric_limits<int64_t>::max())
+		return int64_t(x);
+
+	return uint64_t(x);
+}
+
+template <typename T>
+void fill(summary & s, const partial<T> & p)
+{
+	s.count = p.count;
+
+	if (p.count == 0)
+		return;
+
+	if constexpr (std::is_same_v<T, __int128>)
+	{
+		s.min = exact_number(p.min);
+		s.max = exact_number(p.max);
+	} else
+	{
+		s.min = p.min;
+		s.max = p.max;
+	}
+
+	if constexpr (std::is_floating_point_v<T>)
+		s.float_sum = p.sum;
+	else
+		s.integer_sum = p.sum;
+}
+
+template <typename T>
+void count_buckets(const std::vector<T> & values, const column & c,
+                   double low, double high, std::vector<uint64_t> & counts)
+{
+	double scale = counts.size() / (high - low);
+
+	for (size_t row = 0; row < values.size(); ++row)
+	{
+		double x = static_cast<double>(values[row]);
+
+		if (x >= low && x < high && c.is_valid(row))
+			++counts[std::min(counts.size() - 1, size_t((x - low) * scale))];
+	}
+}
+
+} // namespace
+
+double summary::mean() const
+{
+	if (count == 0)
+		return std::nan("");
+
+	return sum() / count;
+}
+
+summary summarize(const column & c, unsigned threads)
+{
+	summary s;
+	s.type = c.type();
+
+	switch (c.type())
+	{
+	 case column_type::int64:
+		fill(s, reduce_parallel(c.int64s(), c.validity_bitmap(), c.size(), threads));
+		break;
+	 case column_type::uint64:
+		fill(s, reduce_parallel(c.uint64s(), c.validity_bitmap(), c.size(), threads));
+		break;
+	 case column_type::int128:
+		fill(s, reduce_parallel(c.int128s(), c.validity_bitmap(), c.size(), threads));
+		break;
+	 case column_type::float64:
+		fill(s, reduce_parallel(c.float64s(), c.validity_bitmap(), c.size(), threads));
+		break;
+	 case column_type::none:
+	 case column_type::boolean:
+	 case column_type::string:
+		s.count = c.size() - c.null_count();
+		break;
+	}
+
+	return s;
+}
+
+summary summarize(const column_set & columns, std::string_view name,
+                  unsigned threads)
+{
+	const column * c = columns.find(name);
+
+	if ( ! c)
+		throw std::runtime_error("no column named '" + std::string(name) + "'");
+
+	return summarize(*c, threads);
+}
+
+summary summarize(const column_set & columns, const pointer & selector,
+                  unsigned threads)
+{
+	const column * c = columns.find(selector);
+
+	if ( ! c)
+		throw std::runtime_error("no column at '" + selector.str() + "'");
+
+	return summarize(*c, threads);
+}
+
+std::vector<uint64_t> histogram(const column & c, double low, double high,
+                                size_t buckets)
+{
+	if (buckets == 0 || ! (low < high))
+		throw std::runtime_error("histogram needs buckets and low < high");
+
+	std::vector<uint64_t> counts(buckets);
+
+	switch (c.type())
+	{
+	 case column_type::int64: count_buckets(c.int64s(), c, low, high, counts); break;
+	 case column_type::uint64: count_buckets(c.uint64s(), c, low, high, counts); break;
+	 case column_type::int128: count_buckets(c.int128s(), c, low, high, counts); break;
+	 case column_type::float64: count_buckets(c.float64s(), c, low, high, counts); break;
+	 case column_type::none: break;
+	 case column_type::boolean:
+	 case column_type::string:
+		throw std::runtime_error("column '" + c.name() + "' is not numeric");
+	}
+
+	return counts;
+}
+
+} // namespace serial
@@ -0,0 +1,60 @@
+#ifndef SERIAL_AGGREGATE_H
+#define SERIAL_AGGREGATE_H 1
+
+#include <cstdint>
+
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "columns.h"
+
+namespace serial {
+
+using number = std::variant<std::monostate, int64_t, uint64_t, double>;
+
+// Count, sum, min, max and mean over the non-null values of a numeric
+// column.  Integer columns, int128 ones included, are summed exactly in
+// 128 bits; min and max keep the column's own type, or for int128 are
+// int64 when negative and uint64 above INT64_MAX.
+struct summary
+{
+	column_type type = column_type::none;
+	uint64_t count = 0;
+	number min;
+	number max;
+	__int128 integer_sum = 0;
+	double float_sum = 0;
+
+	double sum() const
+		{ return type == column_type::float64 ? float_sum
+		                                      : static_cast<double>(integer_sum); }
+
+	double mean() const;
+};
+
+// Columns larger than this are split across threads.
+static constexpr size_t parallel_rows = 1 << 20;
+
+// threads == 0 uses one per hardware thread for large columns.  Boolean
+// and string columns only get a count.
+summary summarize(const column & c, unsigned threads = 0);
+
+// Looks the column up by name (the path below the record, e.g. "a.b");
+// throws if there is no such column.
+summary summarize(const column_set & columns, std::string_view name,
+                  unsigned threads = 0);
+
+// Looks the column up by path selector, a JSON pointer below the record
+// ("/a/b", "/tags/0"); throws if there is no such column.
+summary summarize(const column_set & columns, const pointer & selector,
+                  unsigned threads = 0);
+
+// Counts the non-null values of a numeric column in equal-width buckets
+// over [low, high); values outside the range are not counted.
+std::vector<uint64_t> histogram(const column & c, double low, double high,
+                                size_t buckets);
+
+} // namespace serial
+
+#endif // SERIAL_AGGREGATE_H
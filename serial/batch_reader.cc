@@ -0,0 +1,418 @@
+#include "batch_reader.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "util/error_handling.h"
+#include "util/file_descriptor.h"
+#include "util/uring.h"
+
+namespace serial::json {
+
+struct batch_reader::loaded_file
+{
+	size_t index = 0;
+	std::vector<char> data;
+	std::exception_ptr error;
+};
+
+class batch_reader::work_queue
+{
+ public:
+	work_queue(size_t limit) : limit(limit), closed(false) { }
+
+	void push(loaded_file && file)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&]{ return files.size() < limit; });
+		files.push_back(std::move(file));
+		changed.notify_all();
+	}
+
+	bool pop(loaded_file & file)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [&]{ return ! files.empty() || closed; });
+
+		if (files.empty())
+			return false;
+
+		file = std::move(files.front());
+		files.pop_front();
+		changed.notify_all();
+
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		changed.notify_all();
+	}
+
+ private:
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<loaded_file> files;
+	size_t limit;
+	bool closed;
+};
+
+namespace {
+
+std::exception_ptr file_error(int error, const stdfs::path & filename)
+{
+	return std::make_exception_ptr(std::system_error(
+		error, std::system_category(),
+		"Could not read file '" + filename.string() + "'"));
+}
+
+} // anonymous namespace
+
+batch_reader::batch_reader(const batch_options & options,
+                           const parse_options & parsing)
+  : options(options)
+  , parsing(parsing)
+  , io_uring_used(false)
+{
+	if (this->options.max_in_flight == 0)
+		this->options.max_in_flight = 1;
+}
+
+void batch_reader::read_files(const std::vector<stdfs::path> & files,
+                              const visitor_source & visitor_for)
+{
+	unsigned workers = options.workers;
+
+	if (workers == 0)
+		workers = std::max(1u, std::thread::hardware_concurrency());
+
+	std::mutex error_lock;
+	std::exception_ptr first_error;
+	size_t first_error_index = std::numeric_limits<size_t>::max();
+
+	auto parse_one = [&](loaded_file & file) {
+		try {
+			if (file.error)
+				std::rethrow_exception(file.error);
+
+			// Each worker reuses its parser, and its buffers, across files
+			auto p = parser_pool::acquire(parsing);
+			p->parse_buffer(file.data.data(), file.data.size(),
+			                visitor_for(file.index));
+		} catch (...)
+		{
+			std::lock_guard<std::mutex> guard(error_lock);
+
+			if (file.index < first_error_index)
+			{
+				first_error = std::current_exception();
+				first_error_index = file.index;
+			}
+		}
+	};
+
+	std::unique_ptr<util::uring> ring;
+
+	if (options.use_io_uring)
+	{
+		try {
+			ring = std::make_unique<util::uring>(options.max_in_flight * 4);
+		} catch (const std::system_error &)
+		{
+			// Not supported by this kernel or not permitted; use read()
+		}
+
+		// Kernels before 5.6 have io_uring but not these operations
+		if (ring)
+			for (unsigned op : { IORING_OP_OPENAT, IORING_OP_STATX,
+			                     IORING_OP_READ, IORING_OP_CLOSE })
+				if ( ! ring->supports(op))
+				{
+					ring.reset();
+					break;
+				}
+	}
+
+	io_uring_used = (ring != nullptr);
+
+	std::vector<std::thread> threads;
+
+	if (ring)
+	{
+		work_queue queue(options.max_in_flight);
+
+		for (unsigned i = 0; i < workers; ++i)
+			threads.emplace_back([&]{
+				loaded_file file;
+
+				while (queue.pop(file))
+					parse_one(file);
+			});
+
+		try {
+			load_with_uring(*ring, files, queue);
+		} catch (...)
+		{
+			queue.close();
+			for (auto & t : threads)
+				t.join();
+			throw;
+		}
+
+		queue.close();
+
+		for (auto & t : threads)
+			t.join();
+	} else
+	{
+		std::atomic<size_t> next_file(0);
+
+		auto work = [&]{
+			size_t i;
+
+			while ((i = next_file++) < files.size())
+			{
+				loaded_file file;
+				file.index = i;
+
+				try {
+					load_with_read(files[i], file);
+				} catch (...)
+				{
+					file.error = std::current_exception();
+				}
+
+				parse_one(file);
+			}
+		};
+
+		for (unsigned i = 1; i < workers; ++i)
+			threads.emplace_back(work);
+
+		work();
+
+		for (auto & t : threads)
+			t.join();
+	}
+
+	if (first_error)
+		std::rethrow_exception(first_error);
+}
+
+void batch_reader::load_with_uring(util::uring & ring,
+                                   const std::vector<stdfs::path> & files,
+                                   work_queue & queue)
+{
+	enum : uint64_t { op_open, op_statx, op_read, op_close, op_bits = 2 };
+
+	struct slot
+	{
+		int fd = -1;
+		unsigned outstanding = 0;
+		size_t done = 0;
+		// An operation was refused as unsupported; read() the file instead
+		bool use_read = false;
+		struct statx stx;
+		loaded_file file;
+	};
+
+	std::vector<slot> slots(options.max_in_flight);
+
+	// Files still open if an exception leaves early, e.g. from submit()
+	struct close_open_files
+	{
+		std::vector<slot> & slots;
+
+		~close_open_files()
+		{
+			for (slot & s : slots)
+				if (s.fd >= 0)
+					close(s.fd);
+		}
+	} closer{slots};
+
+	std::vector<unsigned> free_slots;
+	size_t next_file = 0;
+	unsigned active = 0;
+	unsigned closing = 0;
+
+	for (unsigned i = slots.size(); i > 0; --i)
+		free_slots.push_back(i - 1);
+
+	auto finish = [&](unsigned id) {
+		slot & s = slots[id];
+
+		if (s.fd >= 0)
+		{
+			ring.prep_close(s.fd, op_close);
+			++closing;
+		}
+
+		queue.push(std::move(s.file));
+		s = slot();
+
+		free_slots.push_back(id);
+		--active;
+	};
+
+	while (next_file < files.size() || active > 0 || closing > 0)
+	{
+		while (next_file < files.size() && ! free_slots.empty())
+		{
+			unsigned id = free_slots.back();
+			free_slots.pop_back();
+
+			slot & s = slots[id];
+			s.file.index = next_file;
+			s.outstanding = 2;
+
+			// Both only need the path, so they run side by side
+			const char * path = files[next_file].c_str();
+			ring.prep_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC,
+			                 (id << op_bits) | op_open);
+			ring.prep_statx(AT_FDCWD, path, STATX_SIZE, &s.stx,
+			                (id << op_bits) | op_statx);
+
+			++next_file;
+			++active;
+		}
+
+		ring.submit(1);
+
+		io_uring_cqe cqe;
+
+		while (ring.next_completion(cqe))
+		{
+			unsigned op = cqe.user_data & ((1 << op_bits) - 1);
+
+			if (op == op_close)
+			{
+				--closing;
+				continue;
+			}
+
+			unsigned id = cqe.user_data >> op_bits;
+			slot & s = slots[id];
+			bool eof = false;
+
+			--s.outstanding;
+
+			if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP)
+			{
+				s.use_read = true;
+			} else if (cqe.res < 0)
+			{
+				if ( ! s.file.error)
+					s.file.error = file_error(-cqe.res,
+					                          files[s.file.index]);
+			} else if (op == op_open)
+			{
+				s.fd = cqe.res;
+			} else if (op == op_read)
+			{
+				s.done += cqe.res;
+				eof = (cqe.res == 0);
+			}
+
+			if (s.outstanding > 0)
+				continue;
+
+			if (s.use_read)
+			{
+				s.file.error = nullptr;
+
+				try {
+					load_with_read(files[s.file.index], s.file);
+				} catch (...)
+				{
+					s.file.error = std::current_exception();
+				}
+
+				finish(id);
+				continue;
+			}
+
+			if (s.file.error)
+			{
+				finish(id);
+				continue;
+			}
+
+			if (op != op_read)
+				s.file.data.resize(s.stx.stx_size);
+
+			// The file shrank since it was stat'ed
+			if (eof)
+				s.file.data.resize(s.done);
+
+			if (s.done < s.file.data.size())
+			{
+				size_t len = std::min<size_t>(s.file.data.size() - s.done,
+				                              1 << 30);
+
+				ring.prep_read(s.fd, s.file.data.data() + s.done, len,
+				               s.done, (id << op_bits) | op_read);
+				++s.outstanding;
+			} else
+			{
+				finish(id);
+			}
+		}
+	}
+}
+
+void batch_reader::load_with_read(const stdfs::path & filename,
+                                  loaded_file & file)
+{
+	util::file_descriptor fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		util::throw_errno("Could not open file '%s'", filename.c_str());
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		util::throw_errno("Could not stat file '%s'", filename.c_str());
+
+	file.data.resize(st.st_size);
+
+	size_t done = 0;
+
+	while (done < file.data.size())
+	{
+		ssize_t n = pread(fd, file.data.data() + done,
+		                  file.data.size() - done, done);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			util::throw_errno("Could not read file '%s'", filename.c_str());
+		}
+
+		if (n == 0)
+		{
+			file.data.resize(done);
+			break;
+		}
+
+		done += n;
+	}
+}
+
+} // namespace serial::json
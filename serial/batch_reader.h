@@ -0,0 +1,69 @@
+#ifndef SERIAL_BATCH_READER_H
+#define SERIAL_BATCH_READER_H 1
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#include "json.h"
+
+namespace util { class uring; }
+
+namespace serial::json {
+
+struct batch_options
+{
+	// Threads parsing loaded files; 0 uses one per hardware thread.
+	unsigned workers = 0;
+
+	// Files being opened/read at any one time, which also bounds how many
+	// loaded but not yet parsed buffers are held in memory.
+	unsigned max_in_flight = 64;
+
+	// Load through io_uring when the kernel allows it.  Otherwise, or if
+	// this is false, each worker loads its own files with read().
+	bool use_io_uring = true;
+};
+
+// Loads and parses many files concurrently.  Start-up cost for thousands
+// of small files is dominated by open/stat/read latency rather than by
+// parsing, so the I/O is batched through io_uring (or spread over the
+// workers) and parsing is spread over a pool of threads.
+class batch_reader
+{
+ public:
+	// Called on a worker thread for each file, with the file's index in
+	// the list passed to read_files(); returns the visitor receiving that
+	// file's data.  Distinct files may be visited concurrently.
+	using visitor_source = std::function<data_visitor & (size_t index)>;
+
+	batch_reader(const batch_options & options = batch_options(),
+	             const parse_options & parsing = parse_options());
+
+	// Reads and parses every file.  A failure on one file does not stop
+	// the others; once all are done, the first error is rethrown.
+	void read_files(const std::vector<stdfs::path> & files,
+	                const visitor_source & visitor_for);
+
+	// Whether the last read_files() call went through io_uring.
+	bool used_io_uring() const { return io_uring_used; }
+
+ private:
+	struct loaded_file;
+	class work_queue;
+
+	void load_with_uring(util::uring & ring,
+	                     const std::vector<stdfs::path> & files,
+	                     work_queue & queue);
+
+	static void load_with_read(const stdfs::path & filename,
+	                           loaded_file & file);
+
+	batch_options options;
+	parse_options parsing;
+	bool io_uring_used;
+};
+
+} // namespace serial::json
+
+#endif // SERIAL_BATCH_READER_H
@@ -0,0 +1,58 @@
+#ifndef SERIAL_BINARY_INPUT_H
+#define SERIAL_BINARY_INPUT_H 1
+
+#include <cstdint>
+
+#include <string>
+
+#include "file_reader.h"
+#include "limits.h"
+
+namespace serial {
+
+// Options the binary format readers (CBOR, MessagePack) have in common
+struct binary_options
+{
+	// How read_file() gets the file into memory.
+	read_options input;
+
+	// Exceeding one throws limit_exceeded
+	parse_limits limits;
+};
+
+// Reads a file for a decoder that needs all of its input at once, and
+// calls decode(buffer, n) on it.  Input that read_file() delivers whole is
+// decoded where it lies; compressed or streamed input is collected into
+// collected first, and throws limit_exceeded past max_bytes.
+template <typename Decode>
+read_stats read_binary_file(const stdfs::path & filename,
+                            const read_options & options, uint64_t max_bytes,
+                            std::string & collected, Decode && decode)
+{
+	bool decoded = false;
+	collected.clear();
+
+	read_stats stats = read_file(filename, options,
+		[&](const char * chunk, size_t n, bool whole) {
+			if (whole)
+			{
+				decode(chunk, n);
+				decoded = true;
+				return;
+			}
+
+			collected.append(chunk, n);
+
+			if (collected.size() > max_bytes)
+				throw limit_exceeded(limit::bytes, max_bytes);
+		});
+
+	if ( ! decoded)
+		decode(collected.data(), collected.size());
+
+	return stats;
+}
+
+} // namespace serial
+
+#endif // SERIAL_BINARY_INPUT_H
@@ -0,0 +1,308 @@
+#include "canonical.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "writer.h"
+
+namespace serial {
+
+namespace {
+
+// Flush to the stream once this much output is buffered
+static constexpr size_t flush_size = 64 * 1024;
+
+// Exponents beyond this are left as written rather than risk overflow
+static constexpr int64_t max_big_exponent = 100000000000000000;
+
+// JSON number text as significant digits and a power of ten:
+// "-12.50e3" is 125 * 10^2.  Returns false for an exponent too large.
+bool split_number(std::string_view text, bool & negative,
+                  std::string & digits, int64_t & exponent)
+{
+	size_t i = 0;
+	negative = (i < text.size() && text[i] == '-');
+	if (negative)
+		++i;
+
+	digits.clear();
+	exponent = 0;
+
+	for (bool fraction = false; i < text.size(); ++i)
+	{
+		char c = text[i];
+
+		if (c == '.')
+		{
+			fraction = true;
+		} else if (c >= '0' && c <= '9')
+		{
+			if (c != '0' || ! digits.empty())
+				digits.push_back(c);
+			if (fraction)
+				--exponent;
+		} else
+		{
+			break;
+		}
+	}
+
+	if (i < text.size())
+	{
+		// [eE][+-]?digits
+		bool negative_exponent = (text[++i] == '-');
+		if (text[i] == '-' || text[i] == '+')
+			++i;
+
+		int64_t e = 0;
+
+		for (; i < text.size(); ++i)
+		{
+			if (e > max_big_exponent)
+				return false;
+			e = e * 10 + (text[i] - '0');
+		}
+
+		exponent += negative_exponent ? -e : e;
+	}
+
+	size_t zeros = digits.size() - std::min(digits.size(),
+	                                        digits.find_last_not_of('0') + 1);
+	digits.resize(digits.size() - zeros);
+	exponent += zeros;
+
+	return true;
+}
+
+// A big_number in the style of the ECMAScript rules that JCS uses for
+// doubles, but from all of its digits: integers in full unless they end
+// in more than 21 zeros, a decimal point for fractions from 1e-6, and
+// otherwise one digit before the point and an exponent, e.g. "1.5e+30".
+void append_big_number(std::string & out, std::string_view text)
+{
+	bool negative;
+	std::string digits;
+	int64_t exponent;
+
+	if ( ! split_number(text, negative, digits, exponent))
+	{
+		out += text;
+		return;
+	}
+
+	if (digits.empty())
+	{
+		out.push_back('0');
+		return;
+	}
+
+	if (negative)
+		out.push_back('-');
+
+	// Position of the decimal point relative to the first digit
+	int64_t k = digits.size();
+	int64_t n = k + exponent;
+
+	if (exponent >= 0 && exponent <= 21)
+	{
+		out += digits;
+		out.append(exponent, '0');
+	} else if (n > 0 && n < k)
+	{
+		out.append(digits, 0, n);
+		out.push_back('.');
+		out.append(digits, n);
+	} else if (n <= 0 && n > -6)
+	{
+		out += "0.";
+		out.append(-n, '0');
+		out += digits;
+	} else
+	{
+		out.push_back(digits[0]);
+
+		if (k > 1)
+		{
+			out.push_back('.');
+			out.append(digits, 1);
+		}
+
+		out += n - 1 < 0 ? "e-" : "e+";
+		out += std::to_string(n - 1 < 0 ? -(n - 1) : n - 1);
+	}
+}
+
+} // namespace
+
+bool utf16_less(std::string_view a, std::string_view b)
+{
+	auto [i, j] = std::mismatch(a.begin(), a.end(), b.begin(), b.end());
+
+	if (j == b.end())
+		return false;
+
+	if (i == a.end())
+		return true;
+
+	unsigned char x = *i;
+	unsigned char y = *j;
+
+	// UTF-8 byte order is code point order, which matches UTF-16 order
+	// except that characters from U+10000 up (lead bytes 0xf0-0xf4) are
+	// surrogate pairs and sort below U+E000-U+FFFF (lead bytes 0xee, 0xef).
+	// A difference in a continuation byte means the same lead byte.
+	if (x >= 0xf0 && (y == 0xee || y == 0xef))
+		return true;
+
+	if (y >= 0xf0 && (x == 0xee || x == 0xef))
+		return false;
+
+	return x < y;
+}
+
+canonical_writer::canonical_writer()
+  : buffer()
+  , scratch()
+  , sink(nullptr)
+	{ }
+
+void canonical_writer::write(std::ostream & out, const value & v)
+{
+	buffer.clear();
+	sink = &out;
+
+	add(v);
+	flush(out);
+
+	sink = nullptr;
+}
+
+const std::string & canonical_writer::to_string(const value & v)
+{
+	buffer.clear();
+	sink = nullptr;
+
+	add(v);
+
+	return buffer;
+}
+
+void canonical_writer::flush(std::ostream & out)
+{
+	out.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+void canonical_writer::add(const value & v)
+{
+	if (sink && buffer.size() >= flush_size)
+		flush(*sink);
+
+	if (std::holds_alternative<std::string>(v.datum))
+	{
+		append_quoted(buffer, std::get<std::string>(v.datum));
+	} else if (std::holds_alternative<int64_t>(v.datum))
+	{
+		append_number(buffer, std::get<int64_t>(v.datum));
+	} else if (std::holds_alternative<uint64_t>(v.datum))
+	{
+		append_number(buffer, std::get<uint64_t>(v.datum));
+	} else if (std::holds_alternative<double>(v.datum))
+	{
+		append_number(buffer, std::get<double>(v.datum));
+	} else if (std::holds_alternative<big_number>(v.datum))
+	{
+		append_big_number(buffer, std::get<big_number>(v.datum).text);
+	} else if (std::holds_alternative<bool>(v.datum))
+	{
+		buffer += std::get<bool>(v.datum) ? "true" : "false";
+	} else if (std::holds_alternative<std::nullptr_t>(v.datum))
+	{
+		buffer += "null";
+	} else if (std::holds_alternative<value::array_ptr_type>(v.datum))
+	{
+		const auto & a = std::get<value::array_ptr_type>(v.datum);
+
+		buffer.push_back('[');
+
+		if (a)
+			for (size_t i = 0; i < a->size(); ++i)
+			{
+				if (i)
+					buffer.push_back(',');
+				add((*a)[i]);
+			}
+
+		buffer.push_back(']');
+	} else if (v.is_packed_array())
+	{
+		const auto & a = std::get<value::packed_array_ptr_type>(v.datum);
+		bool first = true;
+
+		buffer.push_back('[');
+
+		a->for_each([&](auto x) {
+			if ( ! first)
+				buffer.push_back(',');
+			first = false;
+
+			if constexpr (std::is_same_v<decltype(x), value>)
+				add(x);
+			else if constexpr (std::is_same_v<decltype(x), bool>)
+				buffer += x ? "true" : "false";
+			else
+				append_number(buffer, x);
+
+			if (sink && buffer.size() >= flush_size)
+				flush(*sink);
+		});
+
+		buffer.push_back(']');
+	} else if (std::holds_alternative<value::object_ptr_type>(v.datum))
+	{
+		const auto & o = std::get<value::object_ptr_type>(v.datum);
+
+		buffer.push_back('{');
+
+		if (o && ! o->empty())
+		{
+			size_t first = scratch.size();
+
+			for (const auto & m : *o)
+				scratch.push_back(&m);
+
+			std::sort(scratch.begin() + first, scratch.end(),
+			          [](const member * x, const member * y)
+			          { return utf16_less(x->first, y->first); });
+
+			// By index: nested objects append to scratch while we walk
+			for (size_t i = first; i < first + o->size(); ++i)
+			{
+				if (i != first)
+					buffer.push_back(',');
+				append_quoted(buffer, scratch[i]->first);
+				buffer.push_back(':');
+				add(scratch[i]->second);
+			}
+
+			scratch.resize(first);
+		}
+
+		buffer.push_back('}');
+	}
+}
+
+void write_canonical(std::ostream & out, const value & v)
+{
+	canonical_writer().write(out, v);
+}
+
+std::string to_canonical(const value & v)
+{
+	canonical_writer writer;
+	return writer.to_string(v);
+}
+
+} // namespace serial
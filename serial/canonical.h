@@ -0,0 +1,60 @@
+#ifndef SERIAL_CANONICAL_H
+#define SERIAL_CANONICAL_H 1
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "data_visitor.h"
+
+namespace serial {
+
+// Deterministic JSON in the manner of RFC 8785 (JCS): no whitespace,
+// object members sorted by the UTF-16 code units of their keys, numbers
+// in their shortest round-trip form, and only the escapes JSON requires.
+// Exact big_numbers, which JCS has no form for, are normalized from their
+// significant digits in the same style, so "1.50e2" and "150" both come
+// out as 150.
+// The same tree always produces the same bytes, whatever order the
+// unordered_map happens to iterate in, so the output can be hashed or
+// used as a cache key.
+//
+// A writer can be reused; its sort scratch space and output buffer keep
+// their capacity between documents.
+class canonical_writer
+{
+ public:
+	canonical_writer();
+
+	// Throws std::runtime_error for NaN and infinities, which JSON cannot
+	// represent.
+	void write(std::ostream & out, const value & v);
+
+	// The canonical text, valid until the next call
+	const std::string & to_string(const value & v);
+
+ private:
+	using member = value::object_type::value_type;
+
+	void add(const value & v);
+
+	void flush(std::ostream & out);
+
+	std::string buffer;
+	// Members of the objects being written; each object sorts its own
+	// range at the end and drops it when done
+	std::vector<const member *> scratch;
+	std::ostream * sink;
+};
+
+void write_canonical(std::ostream & out, const value & v);
+
+std::string to_canonical(const value & v);
+
+// Orders UTF-8 strings by their UTF-16 code units, as JCS sorts keys.
+bool utf16_less(std::string_view a, std::string_view b);
+
+} // namespace serial
+
+#endif // SERIAL_CANONICAL_H
@@ -0,0 +1,373 @@
+#include "cbor.h"
+
+#include <cmath>
+#include <ostream>
+
+namespace serial::cbor {
+
+template class basic_reader<data_visitor>;
+
+namespace {
+
+// Arbitrary precision magnitudes for bignums, as 32-bit limbs, least
+// significant first
+using limbs = std::vector<uint32_t>;
+
+void multiply_add(limbs & n, uint32_t factor, uint32_t addend)
+{
+	uint64_t carry = addend;
+
+	for (auto & limb : n)
+	{
+		carry += uint64_t(limb) * factor;
+		limb = uint32_t(carry);
+		carry >>= 32;
+	}
+
+	if (carry)
+		n.push_back(uint32_t(carry));
+}
+
+// Returns the remainder
+uint32_t divide(limbs & n, uint32_t divisor)
+{
+	uint64_t remainder = 0;
+
+	for (size_t i = n.size(); i-- > 0; )
+	{
+		uint64_t x = remainder << 32 | n[i];
+		n[i] = uint32_t(x / divisor);
+		remainder = x % divisor;
+	}
+
+	while ( ! n.empty() && n.back() == 0)
+		n.pop_back();
+
+	return uint32_t(remainder);
+}
+
+void increment(limbs & n)
+{
+	for (auto & limb : n)
+		if (++limb != 0)
+			return;
+
+	n.push_back(1);
+}
+
+// n must not be zero
+void decrement(limbs & n)
+{
+	for (auto & limb : n)
+		if (limb-- != 0)
+			break;
+
+	while ( ! n.empty() && n.back() == 0)
+		n.pop_back();
+}
+
+limbs from_decimal(std::string_view digits)
+{
+	limbs n;
+
+	for (char c : digits)
+		multiply_add(n, 10, c - '0');
+
+	return n;
+}
+
+// Big-endian bytes without leading zeros
+std::string to_bytes(const limbs & n)
+{
+	std::string bytes;
+
+	for (size_t i = n.size(); i-- > 0; )
+		for (int shift = 24; shift >= 0; shift -= 8)
+			if (uint8_t b = n[i] >> shift; b || ! bytes.empty())
+				bytes.push_back(char(b));
+
+	return bytes;
+}
+
+void head(std::string & out, uint8_t major, uint64_t n)
+{
+	uint8_t type = major << 5;
+	char bytes[9];
+
+	if (n < 24)
+	{
+		out.push_back(char(type | n));
+		return;
+	}
+
+	size_t size;
+
+	if (n <= 0xff)
+	{
+		bytes[0] = char(type | 24);
+		bytes[1] = char(n);
+		size = 2;
+	} else if (n <= 0xffff)
+	{
+		bytes[0] = char(type | 25);
+		util::store_big_endian(uint16_t(n), bytes + 1);
+		size = 3;
+	} else if (n <= 0xffffffff)
+	{
+		bytes[0] = char(type | 26);
+		util::store_big_endian(uint32_t(n), bytes + 1);
+		size = 5;
+	} else
+	{
+		bytes[0] = char(type | 27);
+		util::store_big_endian(n, bytes + 1);
+		size = 9;
+	}
+
+	out.append(bytes, size);
+}
+
+void integer(std::string & out, int64_t n)
+{
+	if (n >= 0)
+		head(out, 0, uint64_t(n));
+	else
+		head(out, 1, uint64_t(-1 - n));
+}
+
+void float64(std::string & out, double d)
+{
+	char bytes[9] = { char(0xfb) };
+	uint64_t bits;
+	std::memcpy(&bits, &d, sizeof bits);
+	util::store_big_endian(bits, bytes + 1);
+	out.append(bytes, sizeof bytes);
+}
+
+// Decimal digits, possibly with a '-', as a plain integer or a bignum
+void integer_text(std::string & out, std::string_view text)
+{
+	bool negative = ! text.empty() && text[0] == '-';
+	text.remove_prefix(negative);
+
+	limbs n = from_decimal(text);
+
+	if (negative)
+	{
+		if (n.empty())
+		{
+			head(out, 0, 0);
+			return;
+		}
+
+		decrement(n);
+	}
+
+	if (n.size() <= 2)
+	{
+		uint64_t x = n.empty() ? 0 : n[0];
+
+		if (n.size() == 2)
+			x |= uint64_t(n[1]) << 32;
+
+		head(out, negative, x);
+		return;
+	}
+
+	std::string bytes = to_bytes(n);
+	head(out, 6, negative ? 3 : 2);
+	head(out, 2, bytes.size());
+	out += bytes;
+}
+
+void big(std::string & out, const big_number & number)
+{
+	std::string_view text = number.text;
+	std::string mantissa;
+	int64_t exponent = 0;
+	size_t i = 0;
+
+	if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+	{
+		if (text[i] == '-')
+			mantissa.push_back('-');
+		++i;
+	}
+
+	for (; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i)
+		mantissa.push_back(text[i]);
+
+	if (i < text.size() && text[i] == '.')
+		for (++i; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i)
+		{
+			mantissa.push_back(text[i]);
+			--exponent;
+		}
+
+	if (i < text.size() && (text[i] == 'e' || text[i] == 'E'))
+	{
+		size_t start = i + 1;
+
+		if (start < text.size() && text[start] == '+')
+			++start;
+
+		int64_t e = 0;
+		auto [end, error] = std::from_chars(text.data() + start,
+		                                    text.data() + text.size(), e);
+
+		if (error != std::errc() || end != text.data() + text.size())
+			throw std::runtime_error("CBOR: bad big_number '" + number.text + "'");
+
+		exponent += e;
+		i = text.size();
+	}
+
+	if (i != text.size() || mantissa.empty() || mantissa == "-")
+		throw std::runtime_error("CBOR: bad big_number '" + number.text + "'");
+
+	if (exponent == 0)
+	{
+		integer_text(out, mantissa);
+		return;
+	}
+
+	// Decimal fraction
+	head(out, 6, 4);
+	head(out, 4, 2);
+	integer(out, exponent);
+	integer_text(out, mantissa);
+}
+
+void encode(std::string & out, const value & v)
+{
+	if (std::holds_alternative<std::string>(v.datum))
+	{
+		const auto & s = std::get<std::string>(v.datum);
+		head(out, 3, s.size());
+		out += s;
+	} else if (std::holds_alternative<int64_t>(v.datum))
+	{
+		integer(out, std::get<int64_t>(v.datum));
+	} else if (std::holds_alternative<uint64_t>(v.datum))
+	{
+		head(out, 0, std::get<uint64_t>(v.datum));
+	} else if (std::holds_alternative<double>(v.datum))
+	{
+		float64(out, std::get<double>(v.datum));
+	} else if (std::holds_alternative<big_number>(v.datum))
+	{
+		big(out, std::get<big_number>(v.datum));
+	} else if (std::holds_alternative<bool>(v.datum))
+	{
+		out.push_back(char(std::get<bool>(v.datum) ? 0xf5 : 0xf4));
+	} else if (std::holds_alternative<std::nullptr_t>(v.datum))
+	{
+		out.push_back(char(0xf6));
+	} else if (std::holds_alternative<value::array_ptr_type>(v.datum))
+	{
+		const auto & a = std::get<value::array_ptr_type>(v.datum);
+		head(out, 4, a ? a->size() : 0);
+
+		if (a)
+			for (const auto & element : *a)
+				encode(out, element);
+	} else if (v.is_packed_array())
+	{
+		const auto & a = std::get<value::packed_array_ptr_type>(v.datum);
+		head(out, 4, a->size());
+
+		a->for_each([&](auto x) {
+			if constexpr (std::is_same_v<decltype(x), value>)
+				encode(out, x);
+			else if constexpr (std::is_same_v<decltype(x), bool>)
+				out.push_back(char(x ? 0xf5 : 0xf4));
+			else if constexpr (std::is_same_v<decltype(x), double>)
+				float64(out, x);
+			else if constexpr (std::is_same_v<decltype(x), int64_t>)
+				integer(out, x);
+			else
+				head(out, 0, x);
+		});
+	} else if (std::holds_alternative<value::object_ptr_type>(v.datum))
+	{
+		const auto & o = std::get<value::object_ptr_type>(v.datum);
+		head(out, 5, o ? o->size() : 0);
+
+		if (o)
+			for (const auto & [key, member] : *o)
+			{
+				head(out, 3, key.size());
+				out += key;
+				encode(out, member);
+			}
+	}
+}
+
+} // namespace
+
+void write(std::ostream & out, const value & v)
+{
+	std::string bytes = encode(v);
+	out.write(bytes.data(), bytes.size());
+}
+
+std::string encode(const value & v)
+{
+	std::string out;
+	encode(out, v);
+	return out;
+}
+
+namespace detail {
+
+std::string bignum_text(const uint8_t * bytes, size_t size, bool negative)
+{
+	limbs n;
+
+	for (size_t i = 0; i < size; ++i)
+		multiply_add(n, 256, bytes[i]);
+
+	if (negative)
+		increment(n);
+
+	// Nine digits at a time, least significant first
+	std::string text;
+
+	do
+	{
+		uint32_t group = divide(n, 1000000000);
+
+		for (int i = 0; i < 9 && (group || ! n.empty()); ++i)
+		{
+			text.push_back(char('0' + group % 10));
+			group /= 10;
+		}
+	} while ( ! n.empty());
+
+	if (text.empty())
+		text.push_back('0');
+
+	if (negative)
+		text.push_back('-');
+
+	return std::string(text.rbegin(), text.rend());
+}
+
+double half_to_double(uint16_t half)
+{
+	int exponent = (half >> 10) & 0x1f;
+	double magnitude = half & 0x3ff;
+
+	if (exponent == 0)
+		magnitude = std::ldexp(magnitude, -24);
+	else if (exponent != 31)
+		magnitude = std::ldexp(magnitude + 1024, exponent - 25);
+	else
+		magnitude = magnitude == 0 ? INFINITY : NAN;
+
+	return half & 0x8000 ? -magnitude : magnitude;
+}
+
+} // namespace detail
+
+} // namespace serial::cbor
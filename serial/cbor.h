@@ -0,0 +1,564 @@
+#ifndef SERIAL_CBOR_H
+#define SERIAL_CBOR_H 1
+
+#include <cstdint>
+#include <cstring>
+
+#include <charconv>
+#include <filesystem>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "binary_input.h"
+#include "data_visitor.h"
+#include "util/endian.h"
+
+namespace serial::cbor {
+
+namespace stdfs = std::filesystem;
+
+struct parse_options : binary_options
+{
+	// Bignums beyond 64 bits, negative integers below INT64_MIN and decimal
+	// fractions are handed over as big_number, as the JSON parser does for
+	// numbers it cannot hold exactly.  Otherwise they become the nearest
+	// double.
+	bool exact_numbers = false;
+};
+
+// Decodes one CBOR data item (RFC 8949) and hands its values to
+// Visitor::add_datum() the way the JSON parser would: non-negative
+// integers as uint64_t, negative ones as int64_t, floats of every width
+// as double, and arrays and maps as paths.  Text and byte strings both
+// become std::string; the text is not checked for valid UTF-8.  Map keys
+// must be strings or integers, which become their decimal text.  Tags
+// other than bignums (2, 3) and decimal fractions (4) are skipped.
+// Malformed or truncated input throws std::runtime_error.
+template <typename Visitor>
+class basic_reader
+{
+ public:
+	using visitor_type = Visitor;
+
+	basic_reader(const parse_options & options = parse_options());
+
+	// Reads and decodes a file, or standard input for "-", decompressing
+	// gzip and zstd input.  The file must hold exactly one data item.
+	void read_file(const stdfs::path & filename, Visitor & data);
+
+	// Decodes the data item at the start of buffer; returns its size.
+	size_t parse(const char * buffer, size_t n, Visitor & data);
+
+	// How the last read_file() call loaded its input.
+	const read_stats & last_read_stats() const { return last_read; }
+
+ private:
+	struct level
+	{
+		// Items, or pairs for a map, still to come
+		uint64_t remaining;
+		uint64_t index;
+		bool map;
+		bool indefinite;
+	};
+
+	uint8_t next();
+
+	uint8_t peek();
+
+	const uint8_t * take(uint64_t n);
+
+	uint64_t argument(uint8_t info);
+
+	void item(Visitor & data);
+
+	void open_container(bool map, uint8_t info, Visitor & data);
+
+	void simple(uint8_t info, Visitor & data);
+
+	void number_tag(uint64_t tag, Visitor & data);
+
+	void publish_big_number(std::string && text, Visitor & data);
+
+	// Appends a definite or indefinite-length string
+	void read_string(uint8_t major, uint8_t info, std::string & out);
+
+	void read_key(std::string & key);
+
+	// An integer or bignum item as decimal text
+	void read_integer_text(std::string & out);
+
+	void check_string_size(uint64_t n);
+
+	const uint8_t * p;
+	const uint8_t * pe;
+	parse_options options;
+	parse_limits limits;
+	uint64_t node_count;
+	read_stats last_read;
+	// The whole input, when read_file() gets it in chunks
+	std::string input;
+	std::string scratch;
+	std::vector<level> open;
+	path object_path;
+};
+
+using reader = basic_reader<data_visitor>;
+
+// Encodes a value tree.  Integers take the shortest head, doubles are
+// always 64 bits and big_number becomes a bignum or a decimal fraction.
+void write(std::ostream & out, const value & v);
+
+std::string encode(const value & v);
+
+namespace detail {
+
+// Decimal text of the big-endian magnitude n, or of -1 - n for negative,
+// which is what bignum tags 2 and 3 mean.
+std::string bignum_text(const uint8_t * bytes, size_t size, bool negative);
+
+double half_to_double(uint16_t half);
+
+inline void append_integer(std::string & out, uint64_t n)
+{
+	char digits[24];
+	out.append(digits, std::to_chars(digits, digits + sizeof digits, n).ptr);
+}
+
+} // namespace detail
+
+//////////////////////////////////////////////////////////////////////
+template <typename Visitor>
+basic_reader<Visitor>::basic_reader(const parse_options & opts)
+  : p(nullptr)
+  , pe(nullptr)
+  , options(opts)
+  , limits(opts.limits.effective())
+  , node_count(0)
+  , last_read()
+  , input()
+  , scratch()
+  , open()
+  , object_path()
+	{ }
+
+template <typename Visitor>
+void basic_reader<Visitor>::read_file(const stdfs::path & filename,
+                                      Visitor & data)
+{
+	// Items can't be decoded piecewise as chunks arrive
+	last_read = read_binary_file(filename, options.input, limits.max_bytes,
+	                             input, [&](const char * buffer, size_t n) {
+		if (parse(buffer, n, data) != n)
+			throw std::runtime_error("CBOR: data after the first item");
+	});
+}
+
+template <typename Visitor>
+size_t basic_reader<Visitor>::parse(const char * buffer, size_t n,
+                                    Visitor & data)
+{
+	if (n > limits.max_bytes)
+		throw limit_exceeded(limit::bytes, limits.max_bytes);
+
+	p = reinterpret_cast<const uint8_t *>(buffer);
+	pe = p + n;
+	open.clear();
+	object_path.clear();
+	node_count = 1;
+
+	item(data);
+
+	while ( ! open.empty())
+	{
+		level & l = open.back();
+		bool end;
+
+		if (l.indefinite)
+		{
+			end = peek() == 0xff;
+			p += end;
+		} else
+		{
+			end = l.remaining == 0;
+			l.remaining -= ! end;
+		}
+
+		if (end)
+		{
+			open.pop_back();
+			object_path.pop_back();
+			continue;
+		}
+
+		if (l.map)
+			read_key(std::get<std::string>(object_path.back()));
+		else
+			std::get<uint64_t>(object_path.back()) = l.index++;
+
+		if (++node_count > limits.max_nodes)
+			throw limit_exceeded(limit::nodes, limits.max_nodes);
+
+		item(data);
+	}
+
+	return p - reinterpret_cast<const uint8_t *>(buffer);
+}
+
+template <typename Visitor>
+inline uint8_t basic_reader<Visitor>::next()
+{
+	if (p == pe)
+		throw std::runtime_error("CBOR: truncated input");
+
+	return *p++;
+}
+
+template <typename Visitor>
+inline uint8_t basic_reader<Visitor>::peek()
+{
+	if (p == pe)
+		throw std::runtime_error("CBOR: truncated input");
+
+	return *p;
+}
+
+template <typename Visitor>
+inline const uint8_t * basic_reader<Visitor>::take(uint64_t n)
+{
+	if (uint64_t(pe - p) < n)
+		throw std::runtime_error("CBOR: truncated input");
+
+	const uint8_t * start = p;
+	p += n;
+
+	return start;
+}
+
+template <typename Visitor>
+inline uint64_t basic_reader<Visitor>::argument(uint8_t info)
+{
+	switch (info)
+	{
+	 case 24: return *take(1);
+	 case 25: return util::load_big_endian<uint16_t>(take(2));
+	 case 26: return util::load_big_endian<uint32_t>(take(4));
+	 case 27: return util::load_big_endian<uint64_t>(take(8));
+	}
+
+	if (info >= 24)
+		throw std::runtime_error("CBOR: unexpected additional information");
+
+	return info;
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::item(Visitor & data)
+{
+	uint8_t initial = next();
+
+	// Other tags only annotate the item that follows
+	while ((initial >> 5) == 6)
+	{
+		uint64_t tag = argument(initial & 0x1f);
+
+		if (tag >= 2 && tag <= 4)
+		{
+			number_tag(tag, data);
+			return;
+		}
+
+		initial = next();
+	}
+
+	uint8_t info = initial & 0x1f;
+
+	switch (initial >> 5)
+	{
+	 case 0:
+		data.add_datum(object_path, argument(info));
+		break;
+	 case 1:
+	 {
+		uint64_t n = argument(info);
+
+		if (n < uint64_t(1) << 63)
+		{
+			data.add_datum(object_path, int64_t(-1) - int64_t(n));
+		} else
+		{
+			uint8_t bytes[8];
+			util::store_big_endian(n, bytes);
+			publish_big_number(detail::bignum_text(bytes, 8, true), data);
+		}
+		break;
+	 }
+	 case 2:
+	 case 3:
+	 {
+		std::string s;
+		read_string(initial >> 5, info, s);
+		data.add_datum(object_path, std::move(s));
+		break;
+	 }
+	 case 4:
+	 case 5:
+		open_container(initial >> 5 == 5, info, data);
+		break;
+	 case 7:
+		simple(info, data);
+		break;
+	}
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::open_container(bool map, uint8_t info,
+                                           Visitor & data)
+{
+	bool indefinite = info == 31;
+	uint64_t count = indefinite ? 0 : argument(info);
+	bool empty = indefinite ? peek() == 0xff : count == 0;
+
+	if (empty)
+	{
+		p += indefinite;
+
+		if (map)
+			data.add_datum(object_path, empty_object{});
+		else
+			data.add_datum(object_path, empty_array{});
+
+		return;
+	}
+
+	if (open.size() >= limits.max_depth)
+		throw limit_exceeded(limit::depth, limits.max_depth);
+
+	open.push_back(level{count, 0, map, indefinite});
+
+	if (map)
+		object_path.emplace_back(std::string());
+	else
+		object_path.emplace_back(uint64_t(0));
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::simple(uint8_t info, Visitor & data)
+{
+	switch (info)
+	{
+	 case 20:
+		data.add_datum(object_path, false);
+		break;
+	 case 21:
+		data.add_datum(object_path, true);
+		break;
+	 // null and undefined
+	 case 22:
+	 case 23:
+		data.add_datum(object_path, nullptr);
+		break;
+	 case 25:
+		data.add_datum(object_path,
+			detail::half_to_double(util::load_big_endian<uint16_t>(take(2))));
+		break;
+	 case 26:
+	 {
+		uint32_t bits = util::load_big_endian<uint32_t>(take(4));
+		float f;
+		std::memcpy(&f, &bits, sizeof f);
+		data.add_datum(object_path, double(f));
+		break;
+	 }
+	 case 27:
+	 {
+		uint64_t bits = util::load_big_endian<uint64_t>(take(8));
+		double d;
+		std::memcpy(&d, &bits, sizeof d);
+		data.add_datum(object_path, d);
+		break;
+	 }
+	 case 31:
+		throw std::runtime_error("CBOR: break outside an indefinite-length item");
+	 default:
+		throw std::runtime_error("CBOR: unsupported simple value");
+	}
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::number_tag(uint64_t tag, Visitor & data)
+{
+	if (tag == 4)
+	{
+		// [exponent, mantissa], i.e. mantissa * 10^exponent
+		if (next() != 0x82)
+			throw std::runtime_error("CBOR: decimal fraction is not a pair");
+
+		std::string exponent, mantissa;
+		read_integer_text(exponent);
+		read_integer_text(mantissa);
+
+		mantissa += 'e';
+		mantissa += exponent;
+		publish_big_number(std::move(mantissa), data);
+		return;
+	}
+
+	uint8_t initial = next();
+
+	if ((initial >> 5) != 2)
+		throw std::runtime_error("CBOR: bignum is not a byte string");
+
+	scratch.clear();
+	read_string(2, initial & 0x1f, scratch);
+
+	auto bytes = reinterpret_cast<const uint8_t *>(scratch.data());
+	size_t size = scratch.size();
+
+	while (size && *bytes == 0)
+	{
+		++bytes;
+		--size;
+	}
+
+	if (size > 8)
+	{
+		publish_big_number(detail::bignum_text(bytes, size, tag == 3), data);
+		return;
+	}
+
+	uint64_t n = 0;
+
+	for (size_t i = 0; i < size; ++i)
+		n = n << 8 | bytes[i];
+
+	if (tag == 2)
+		data.add_datum(object_path, n);
+	else if (n < uint64_t(1) << 63)
+		data.add_datum(object_path, int64_t(-1) - int64_t(n));
+	else
+		publish_big_number(detail::bignum_text(bytes, size, true), data);
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::publish_big_number(std::string && text,
+                                               Visitor & data)
+{
+	big_number n{std::move(text)};
+
+	if constexpr (requires (Visitor & v, path & o, big_number && b)
+	              { v.add_datum(o, std::move(b)); })
+	{
+		if (options.exact_numbers)
+		{
+			data.add_datum(object_path, std::move(n));
+			return;
+		}
+	}
+
+	data.add_datum(object_path, n.to_double());
+}
+
+template <typename Visitor>
+inline void basic_reader<Visitor>::check_string_size(uint64_t n)
+{
+	if (n > limits.max_string_bytes)
+		throw limit_exceeded(limit::string_bytes, limits.max_string_bytes);
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::read_string(uint8_t major, uint8_t info,
+                                        std::string & out)
+{
+	if (info != 31)
+	{
+		uint64_t n = argument(info);
+		check_string_size(out.size() + n);
+		out.append(reinterpret_cast<const char *>(take(n)), n);
+		return;
+	}
+
+	// Definite-length chunks of the same type, up to a break
+	for (uint8_t chunk; (chunk = next()) != 0xff; )
+	{
+		if ((chunk >> 5) != major || (chunk & 0x1f) == 31)
+			throw std::runtime_error("CBOR: bad chunk in an indefinite-length string");
+
+		read_string(major, chunk & 0x1f, out);
+	}
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::read_key(std::string & key)
+{
+	uint8_t initial = next();
+
+	while ((initial >> 5) == 6)
+	{
+		argument(initial & 0x1f);
+		initial = next();
+	}
+
+	key.clear();
+
+	switch (initial >> 5)
+	{
+	 case 2:
+	 case 3:
+		read_string(initial >> 5, initial & 0x1f, key);
+		break;
+	 case 0:
+	 case 1:
+		--p;
+		read_integer_text(key);
+		break;
+	 default:
+		throw std::runtime_error("CBOR: map key is not a string or integer");
+	}
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::read_integer_text(std::string & out)
+{
+	uint8_t initial = next();
+	uint8_t info = initial & 0x1f;
+
+	switch (initial >> 5)
+	{
+	 case 0:
+		detail::append_integer(out, argument(info));
+		return;
+	 case 1:
+	 {
+		uint8_t bytes[8];
+		util::store_big_endian(argument(info), bytes);
+		out += detail::bignum_text(bytes, 8, true);
+		return;
+	 }
+	 case 6:
+	 {
+		uint64_t tag = argument(info);
+		initial = next();
+
+		if ((tag != 2 && tag != 3) || (initial >> 5) != 2)
+			break;
+
+		scratch.clear();
+		read_string(2, initial & 0x1f, scratch);
+		out += detail::bignum_text(
+			reinterpret_cast<const uint8_t *>(scratch.data()),
+			scratch.size(), tag == 3);
+		return;
+	 }
+	}
+
+	throw std::runtime_error("CBOR: expected an integer");
+}
+
+extern template class basic_reader<data_visitor>;
+
+} // namespace serial::cbor
+
+#endif // SERIAL_CBOR_H
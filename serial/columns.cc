@@ -0,0 +1,442 @@
+#include "columns.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace serial {
+
+const char * to_string(column_type type)
+{
+	switch (type)
+	{
+	 case column_type::none: return "none";
+	 case column_type::boolean: return "boolean";
+	 case column_type::int64: return "int64";
+	 case column_type::uint64: return "uint64";
+	 case column_type::int128: return "int128";
+	 case column_type::float64: return "float64";
+	 case column_type::string: return "string";
+	}
+
+	return "unknown";
+}
+
+column::column(std::string name, std::string pointer_text)
+  : column_name(std::move(name))
+  , column_pointer(std::move(pointer_text))
+  , kind(column_type::none)
+  , rows(0)
+  , validity()
+  , bool_values()
+  , int_values()
+  , uint_values()
+  , wide_values()
+  , double_values()
+  , chars()
+  , offsets(1, 0)
+	{ }
+
+size_t column::null_count() const
+{
+	size_t valid = 0;
+
+	for (auto word : validity)
+		valid += __builtin_popcountll(word);
+
+	return rows - valid;
+}
+
+size_t column::memory_usage() const
+{
+	return validity.capacity() * sizeof(uint64_t)
+	     + bool_values.capacity()
+	     + int_values.capacity() * sizeof(int64_t)
+	     + uint_values.capacity() * sizeof(uint64_t)
+	     + wide_values.capacity() * sizeof(__int128)
+	     + double_values.capacity() * sizeof(double)
+	     + chars.capacity()
+	     + offsets.capacity() * sizeof(uint64_t);
+}
+
+void column::resize(size_t n)
+{
+	rows = n;
+	validity.resize((n + 63) / 64);
+
+	switch (kind)
+	{
+	 case column_type::none: break;
+	 case column_type::boolean: bool_values.resize(n); break;
+	 case column_type::int64: int_values.resize(n); break;
+	 case column_type::uint64: uint_values.resize(n); break;
+	 case column_type::int128: wide_values.resize(n); break;
+	 case column_type::float64: double_values.resize(n); break;
+	 case column_type::string: offsets.resize(n + 1, chars.size()); break;
+	}
+}
+
+void column::promote(column_type to)
+{
+	if (kind == column_type::none)
+	{
+		kind = to;
+		resize(rows);
+		return;
+	}
+
+	if (to == column_type::float64)
+	{
+		double_values.reserve(rows);
+
+		if (kind == column_type::int64)
+			double_values.assign(int_values.begin(), int_values.end());
+		else if (kind == column_type::uint64)
+			double_values.assign(uint_values.begin(), uint_values.end());
+		else if (kind == column_type::int128)
+			double_values.assign(wide_values.begin(), wide_values.end());
+		else
+			type_mismatch(to);
+
+		int_values = std::vector<int64_t>();
+		uint_values = std::vector<uint64_t>();
+		wide_values = std::vector<__int128>();
+	} else if (to == column_type::int64 && kind == column_type::uint64)
+	{
+		int_values.assign(uint_values.begin(), uint_values.end());
+		uint_values = std::vector<uint64_t>();
+	} else if (to == column_type::int128 && kind == column_type::int64)
+	{
+		wide_values.assign(int_values.begin(), int_values.end());
+		int_values = std::vector<int64_t>();
+	} else if (to == column_type::int128 && kind == column_type::uint64)
+	{
+		wide_values.assign(uint_values.begin(), uint_values.end());
+		uint_values = std::vector<uint64_t>();
+	} else
+	{
+		type_mismatch(to);
+	}
+
+	kind = to;
+}
+
+void column::type_mismatch(column_type other) const
+{
+	throw std::runtime_error("column '" + column_name + "' mixes "
+	                         + to_string(kind) + " and " + to_string(other)
+	                         + " values");
+}
+
+void column::set_null(size_t row)
+{
+	if (row >= rows)
+		resize(row + 1);
+
+	validity[row / 64] &= ~(uint64_t(1) << (row % 64));
+}
+
+void column::set(size_t row, bool datum)
+{
+	if (kind != column_type::boolean)
+		promote(column_type::boolean);
+
+	if (row >= rows)
+		resize(row + 1);
+
+	bool_values[row] = datum;
+	mark_valid(row);
+}
+
+template <typename T>
+void column::store_number(size_t row, T datum)
+{
+	if (row >= rows)
+		resize(row + 1);
+
+	switch (kind)
+	{
+	 case column_type::int64: int_values[row] = datum; break;
+	 case column_type::uint64: uint_values[row] = datum; break;
+	 case column_type::int128: wide_values[row] = datum; break;
+	 default: double_values[row] = datum; break;
+	}
+
+	mark_valid(row);
+}
+
+void column::set(size_t row, int64_t datum)
+{
+	if (kind == column_type::uint64 && datum < 0)
+	{
+		uint64_t largest = 0;
+
+		for (auto x : uint_values)
+			largest = std::max(largest, x);
+
+		if (largest <= uint64_t(std::numeric_limits<int64_t>::max()))
+			promote(column_type::int64);
+		else
+			promote(column_type::int128);
+	} else if (kind != column_type::int64 && kind != column_type::uint64
+	           && kind != column_type::int128 && kind != column_type::float64)
+	{
+		promote(column_type::int64);
+	}
+
+	store_number(row, datum);
+}
+
+void column::set(size_t row, uint64_t datum)
+{
+	if (kind == column_type::int64
+	    && datum > uint64_t(std::numeric_limits<int64_t>::max()))
+		promote(column_type::int128);
+	else if (kind != column_type::int64 && kind != column_type::uint64
+	         && kind != column_type::int128 && kind != column_type::float64)
+		promote(column_type::uint64);
+
+	store_number(row, datum);
+}
+
+void column::set(size_t row, double datum)
+{
+	if (kind != column_type::float64)
+		promote(column_type::float64);
+
+	if (row >= rows)
+		resize(row + 1);
+
+	double_values[row] = datum;
+	mark_valid(row);
+}
+
+void column::set(size_t row, std::string_view datum)
+{
+	if (kind != column_type::string)
+		promote(column_type::string);
+
+	if (row >= rows)
+		resize(row + 1);
+
+	if (row + 1 != rows)
+		throw std::runtime_error("column '" + column_name
+		                         + "': string rows must arrive in order");
+
+	// Replaces the value if the record repeated the key
+	chars.resize(offsets[row]);
+	chars.append(datum);
+	offsets[row + 1] = chars.size();
+
+	mark_valid(row);
+}
+
+//////////////////////////////////////////////////////////////////////
+const column * column_set::find(std::string_view name) const
+{
+	for (const auto & c : columns)
+		if (c.name() == name)
+			return &c;
+
+	return nullptr;
+}
+
+const column * column_set::find(const pointer & p) const
+{
+	for (const auto & c : columns)
+		if (c.pointer_text() == p.str())
+			return &c;
+
+	return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////
+column_builder::column_builder()
+  : data_visitor()
+  , columns()
+  , column_index()
+  , name_buffer()
+  , rows(0)
+  , next_guess(0)
+	{ }
+
+column * column_builder::locate(const path & p, size_t & row)
+{
+	if (p.empty() || ! std::holds_alternative<uint64_t>(p.front()))
+		throw std::runtime_error("columnar input must be an array of records");
+
+	row = std::get<uint64_t>(p.front());
+
+	if (row >= rows)
+		rows = row + 1;
+
+	if (p.size() == 1)
+		return nullptr;
+
+	const std::string * name;
+
+	if (p.size() == 2 && std::holds_alternative<std::string>(p[1]))
+	{
+		name = &std::get<std::string>(p[1]);
+	} else
+	{
+		name_buffer.clear();
+
+		for (auto i = p.begin() + 1; i != p.end(); ++i)
+		{
+			if (std::holds_alternative<std::string>(*i))
+			{
+				if (i != p.begin() + 1)
+					name_buffer.push_back('.');
+				name_buffer += std::get<std::string>(*i);
+			} else
+			{
+				name_buffer.push_back('[');
+				name_buffer += std::to_string(std::get<uint64_t>(*i));
+				name_buffer.push_back(']');
+			}
+		}
+
+		name = &name_buffer;
+	}
+
+	// Records usually repeat their keys in the same order, so try the
+	// column after the previous one before hashing the name.
+	size_t index = next_guess;
+
+	if (index >= columns.size() || columns[index].name() != *name)
+	{
+		auto found = column_index.find(*name);
+
+		if (found != column_index.end())
+		{
+			index = found->second;
+		} else
+		{
+			std::string pointer_text;
+
+			for (auto i = p.begin() + 1; i != p.end(); ++i)
+			{
+				if (std::holds_alternative<std::string>(*i))
+				{
+					append_pointer_token(pointer_text, std::get<std::string>(*i));
+				} else
+				{
+					pointer_text.push_back('/');
+					pointer_text += std::to_string(std::get<uint64_t>(*i));
+				}
+			}
+
+			index = columns.size();
+			columns.emplace_back(*name, std::move(pointer_text));
+			column_index.emplace(*name, index);
+		}
+	}
+
+	next_guess = index + 1;
+
+	return &columns[index];
+}
+
+void column_builder::add_datum(const path & p, const empty_array &)
+{
+	// A top-level [] is a table with no rows
+	if (p.empty())
+		return;
+
+	size_t row;
+
+	if (column * c = locate(p, row))
+		c->set_null(row);
+}
+
+void column_builder::add_datum(const path & p, const empty_object &)
+{
+	size_t row;
+
+	if (column * c = locate(p, row))
+		c->set_null(row);
+}
+
+void column_builder::add_datum(const path & p, std::nullptr_t)
+{
+	size_t row;
+
+	if (column * c = locate(p, row))
+		c->set_null(row);
+}
+
+void column_builder::add_datum(const path & p, bool datum)
+{
+	size_t row;
+	column * c = locate(p, row);
+
+	if ( ! c)
+		throw std::runtime_error("columnar input must be an array of records");
+
+	c->set(row, datum);
+}
+
+void column_builder::add_datum(const path & p, int64_t datum)
+{
+	size_t row;
+	column * c = locate(p, row);
+
+	if ( ! c)
+		throw std::runtime_error("columnar input must be an array of records");
+
+	c->set(row, datum);
+}
+
+void column_builder::add_datum(const path & p, uint64_t datum)
+{
+	size_t row;
+	column * c = locate(p, row);
+
+	if ( ! c)
+		throw std::runtime_error("columnar input must be an array of records");
+
+	c->set(row, datum);
+}
+
+void column_builder::add_datum(const path & p, double datum)
+{
+	size_t row;
+	column * c = locate(p, row);
+
+	if ( ! c)
+		throw std::runtime_error("columnar input must be an array of records");
+
+	c->set(row, datum);
+}
+
+void column_builder::add_datum(const path & p, std::string && datum)
+{
+	size_t row;
+	column * c = locate(p, row);
+
+	if ( ! c)
+		throw std::runtime_error("columnar input must be an array of records");
+
+	c->set(row, std::string_view(datum));
+}
+
+column_set column_builder::finish()
+{
+	column_set result;
+	result.rows = rows;
+
+	for (auto & c : columns)
+		c.resize(rows);
+
+	result.columns = std::move(columns);
+
+	columns.clear();
+	column_index.clear();
+	rows = 0;
+	next_guess = 0;
+
+	return result;
+}
+
+} // namespace serial
@@ -0,0 +1,179 @@
+#ifndef SERIAL_COLUMNS_H
+#define SERIAL_COLUMNS_H 1
+
+#include <cstdint>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "data_visitor.h"
+#include "pointer.h"
+
+namespace serial {
+
+enum class column_type
+{
+	// nothing but nulls seen so far
+	none,
+	boolean,
+	int64,
+	uint64,
+	// both negative values and ones above INT64_MAX
+	int128,
+	float64,
+	string,
+};
+
+const char * to_string(column_type type);
+
+// One field of an array of records, stored contiguously by type.  Rows
+// where the field was null or missing have their validity bit cleared and
+// hold a zero/empty value.
+class column
+{
+ public:
+	column(std::string name, std::string pointer_text);
+
+	const std::string & name() const { return column_name; }
+
+	// The same path as a JSON pointer below the record ("/a/b", "/tags/0")
+	const std::string & pointer_text() const { return column_pointer; }
+
+	column_type type() const { return kind; }
+
+	size_t size() const { return rows; }
+
+	bool is_valid(size_t row) const
+		{ return (validity[row / 64] >> (row % 64)) & 1; }
+
+	size_t null_count() const;
+
+	// Bit (row % 64) of word (row / 64) is set for non-null rows
+	const std::vector<uint64_t> & validity_bitmap() const { return validity; }
+
+	const std::vector<uint8_t> & booleans() const { return bool_values; }
+
+	const std::vector<int64_t> & int64s() const { return int_values; }
+
+	const std::vector<uint64_t> & uint64s() const { return uint_values; }
+
+	const std::vector<__int128> & int128s() const { return wide_values; }
+
+	const std::vector<double> & float64s() const { return double_values; }
+
+	// String values live back to back in one arena; row i spans
+	// [string_offsets()[i], string_offsets()[i + 1]).
+	const std::string & string_arena() const { return chars; }
+
+	const std::vector<uint64_t> & string_offsets() const { return offsets; }
+
+	std::string_view string_at(size_t row) const
+		{ return std::string_view(chars).substr(offsets[row],
+		                                         offsets[row + 1] - offsets[row]); }
+
+	// Approximate heap bytes used by the column
+	size_t memory_usage() const;
+
+ private:
+	friend class column_builder;
+
+	void resize(size_t n);
+
+	void promote(column_type to);
+
+	void set_null(size_t row);
+
+	void set(size_t row, bool datum);
+
+	void set(size_t row, int64_t datum);
+
+	void set(size_t row, uint64_t datum);
+
+	// Into whichever integer or float64 vector the column now uses
+	template <typename T>
+	void store_number(size_t row, T datum);
+
+	void set(size_t row, double datum);
+
+	void set(size_t row, std::string_view datum);
+
+	void mark_valid(size_t row)
+		{ validity[row / 64] |= uint64_t(1) << (row % 64); }
+
+	[[noreturn]] void type_mismatch(column_type other) const;
+
+	std::string column_name;
+	std::string column_pointer;
+	column_type kind;
+	size_t rows;
+	std::vector<uint64_t> validity;
+	std::vector<uint8_t> bool_values;
+	std::vector<int64_t> int_values;
+	std::vector<uint64_t> uint_values;
+	std::vector<__int128> wide_values;
+	std::vector<double> double_values;
+	std::string chars;
+	std::vector<uint64_t> offsets;
+};
+
+struct column_set
+{
+	size_t rows = 0;
+	std::vector<column> columns;
+
+	const column * find(std::string_view name) const;
+
+	// By path selector, a JSON pointer below the record
+	const column * find(const pointer & p) const;
+};
+
+// Builds typed columns from a top-level array of records, i.e. from paths
+// of the form [i].field.  Nested objects become columns named with the
+// dotted path below the record ("a.b"), nested arrays with an index
+// ("tags[0]").  A column's type follows the parser's classification,
+// widening int64/uint64 to the other, or to int128 when one column needs
+// both, so that integers stay exact; only a double makes it float64.
+// Mixing strings, booleans and numbers in one column is an error.
+class column_builder final : public data_visitor
+{
+ public:
+	column_builder();
+
+	using data_visitor::add_datum;
+
+	void add_datum(const path & p, const empty_array &) override;
+
+	void add_datum(const path & p, const empty_object &) override;
+
+	void add_datum(const path & p, std::nullptr_t) override;
+
+	void add_datum(const path & p, bool datum) override;
+
+	void add_datum(const path & p, int64_t datum) override;
+
+	void add_datum(const path & p, uint64_t datum) override;
+
+	void add_datum(const path & p, double datum) override;
+
+	void add_datum(const path & p, std::string && datum) override;
+
+	// Pads every column to the full row count and hands the columns over;
+	// the builder is empty afterwards.
+	column_set finish();
+
+ private:
+	// Returns the column for the field, or nullptr for the record itself.
+	column * locate(const path & p, size_t & row);
+
+	std::vector<column> columns;
+	std::unordered_map<std::string, size_t> column_index;
+	std::string name_buffer;
+	size_t rows;
+	size_t next_guess;
+};
+
+} // namespace serial
+
+#endif // SERIAL_COLUMNS_H
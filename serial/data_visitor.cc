@@ -2,11 +2,32 @@
 
 #include <iostream>
 #include <iomanip>
+#include <charconv>
 
 #include "util/fp_convert.h"
+#include "util/utf8.h"
 
 namespace serial {
 
+void data_visitor::add_datum(const path & object_path,
+                             std::u32string && datum)
+{
+	add_datum(object_path, util::to_utf8(datum));
+}
+
+void data_visitor::add_datum(const path & object_path, big_number && datum)
+{
+	add_datum(object_path, datum.to_double());
+}
+
+double big_number::to_double() const
+{
+	double d = 0;
+	std::from_chars(text.data(), text.data() + text.size(), d);
+	return d;
+}
+
+//////////////////////////////////////////////////////////////////////
 void printing_visitor::print_path(std::ostream & out, const path & object_path)
 {
 	for (const auto & p : object_path)
@@ -61,6 +82,12 @@ void printing_visitor::add_datum(const path & object_path, std::string && datum)
 	std::cout << " -> " << datum << '\n';
 }
 
+void printing_visitor::add_datum(const path & object_path, big_number && datum)
+{
+	print_path(std::cout, object_path);
+	std::cout << " -> " << datum.text << '\n';
+}
+
 //////////////////////////////////////////////////////////////////////
 value::value() : datum() { }
 
@@ -80,6 +107,48 @@ value & value::operator = (value && other) {
 
 value::~value() { }
 
+value::array_ptr_type value::get_array()
+{
+	if (is_packed_array())
+	{
+		auto & packed = std::get<packed_array_ptr_type>(datum);
+
+		// No other value can see this one change form
+		if (packed.use_count() > 1 || packed->unpacked())
+			return packed->unpack_shared();
+
+		datum = std::make_shared<array_type>(packed->unpack());
+	}
+
+	if ( ! is_array() )
+		throw std::runtime_error("get_object called on non-array datum");
+
+	return std::get<array_ptr_type>(datum);
+}
+
+size_t value::array_size() const
+{
+	if (is_packed_array())
+		return std::get<packed_array_ptr_type>(datum)->size();
+
+	if ( ! is_array() )
+		throw std::runtime_error("array_size called on non-array datum");
+
+	const auto & a = std::get<array_ptr_type>(datum);
+	return a ? a->size() : 0;
+}
+
+value value::array_element(size_t i) const
+{
+	if (is_packed_array())
+		return std::get<packed_array_ptr_type>(datum)->at(i);
+
+	if ( ! is_array() )
+		throw std::runtime_error("array_element called on non-array datum");
+
+	return std::get<array_ptr_type>(datum)->at(i);
+}
+
 void value::print(std::ostream & out,
                   unsigned indent,
                   bool indent_first) const
@@ -120,6 +189,9 @@ void value::print(std::ostream & out,
 	} else if (std::holds_alternative<std::nullptr_t>(datum))
 	{
 		out << "null";
+	} else if (std::holds_alternative<big_number>(datum))
+	{
+		out << std::get<big_number>(datum).text;
 	} else if (std::holds_alternative<array_ptr_type>(datum))
 	{
 		const array_type & a = *std::get<array_ptr_type>(datum);
@@ -149,6 +221,22 @@ void value::print(std::ostream & out,
 
 			out << std::string(indent, '\t') << "]";
 		}
+	} else if (std::holds_alternative<packed_array_ptr_type>(datum))
+	{
+		const packed_array & a = *std::get<packed_array_ptr_type>(datum);
+
+		out << "[\n";
+
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (i)
+				out << ",\n";
+			a.at(i).print(out, indent + 1);
+		}
+
+		out << '\n';
+
+		out << std::string(indent, '\t') << "]";
 	} else if (std::holds_alternative<object_ptr_type>(datum))
 	{
 		const object_type & o = *std::get<object_ptr_type>(datum);
@@ -185,4 +273,92 @@ void value::print(std::ostream & out,
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+packed_array::packed_array(elements_type elements)
+  : data(std::move(elements))
+  , generic_lock()
+  , generic()
+  , generic_view(nullptr)
+	{ }
+
+packed_array::packed_array(const packed_array & other)
+  : data(other.data)
+  , generic_lock()
+  , generic()
+  , generic_view(nullptr)
+{
+	if (auto a = other.unpacked())
+	{
+		generic = std::make_shared<value::array_type>(*a);
+		generic_view.store(generic.get(), std::memory_order_release);
+	}
+}
+
+packed_array & packed_array::operator = (const packed_array & other)
+{
+	if (&other == this)
+		return *this;
+
+	std::lock_guard<std::mutex> guard(generic_lock);
+
+	data = other.data;
+
+	if (auto a = other.unpacked())
+		generic = std::make_shared<value::array_type>(*a);
+	else
+		generic.reset();
+
+	generic_view.store(generic.get(), std::memory_order_release);
+	return *this;
+}
+
+packed_array::~packed_array() { }
+
+value packed_array::at(size_t i) const
+{
+	if (i >= size())
+		throw std::out_of_range("packed_array::at");
+
+	if (auto a = unpacked())
+		return (*a)[i];
+
+	value v;
+	std::visit([&](const auto & e) { v.datum = e[i]; }, data);
+	return v;
+}
+
+value::array_type packed_array::unpack() const
+{
+	if (auto a = unpacked())
+		return *a;
+
+	value::array_type elements;
+	elements.reserve(size());
+
+	for_each([&](auto x) {
+		if constexpr (std::is_same_v<decltype(x), value>)
+			elements.push_back(x);
+		else
+			elements.emplace_back().datum = x;
+	});
+
+	return elements;
+}
+
+value::array_ptr_type packed_array::unpack_shared()
+{
+	if (unpacked())
+		return generic;
+
+	std::lock_guard<std::mutex> guard(generic_lock);
+
+	if ( ! generic)
+	{
+		generic = std::make_shared<value::array_type>(unpack());
+		generic_view.store(generic.get(), std::memory_order_release);
+	}
+
+	return generic;
+}
+
 } // namespace serial
@@ -1,15 +1,21 @@
 #ifndef DATA_VISITOR_H
 #define DATA_VISITOR_H 1
 
+#include <atomic>
 #include <cstdint>
 
 #include <iosfwd>
+#include <string>
 #include <vector>
 #include <variant>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <unordered_map>
 #include <stdexcept>
 
+#include "limits.h"
+
 namespace serial {
 
 using path = std::vector<std::variant<std::string, uint64_t>>;
@@ -18,6 +24,19 @@ struct empty_array { };
 
 struct empty_object { };
 
+// A number kept exactly as written, for integers beyond 64 bits and
+// decimals with more digits than a double holds.  The parser only
+// produces these when asked for exact numbers.
+struct big_number
+{
+	std::string text;
+
+	double to_double() const;
+
+	bool operator == (const big_number & other) const
+		{ return text == other.text; }
+};
+
 class data_visitor
 {
  public:
@@ -40,6 +59,13 @@ class data_visitor
 	virtual void add_datum(const path & p, double) = 0;
 
 	virtual void add_datum(const path & p, std::string &&) = 0;
+
+	// Strings from a parser running in UTF-32 mode.  Visitors that only
+	// deal in UTF-8 can leave this alone; it re-encodes and forwards.
+	virtual void add_datum(const path & p, std::u32string &&);
+
+	// Visitors without a use for exact numbers get the nearest double.
+	virtual void add_datum(const path & p, big_number &&);
 };
 
 class printing_visitor : public data_visitor
@@ -49,6 +75,8 @@ class printing_visitor : public data_visitor
 
 	~printing_visitor() { }
 
+	using data_visitor::add_datum;
+
 	void add_datum(const path & p, const empty_array &) override;
 
 	void add_datum(const path & p, const empty_object &) override;
@@ -65,10 +93,89 @@ class printing_visitor : public data_visitor
 
 	void add_datum(const path & p, std::string &&) override;
 
+	void add_datum(const path & p, big_number &&) override;
+
  protected:
 	void print_path(std::ostream & out, const path & object_path);
 };
 
+// Throws everything away; for validating input and for benchmarks.
+class null_visitor final : public data_visitor
+{
+ public:
+	using data_visitor::add_datum;
+
+	void add_datum(const path &, const empty_array &) override { }
+
+	void add_datum(const path &, const empty_object &) override { }
+
+	void add_datum(const path &, std::nullptr_t) override { }
+
+	void add_datum(const path &, bool) override { }
+
+	void add_datum(const path &, int64_t) override { }
+
+	void add_datum(const path &, uint64_t) override { }
+
+	void add_datum(const path &, double) override { }
+
+	void add_datum(const path &, std::string &&) override { }
+
+	void add_datum(const path &, std::u32string &&) override { }
+
+	void add_datum(const path &, big_number &&) override { }
+};
+
+// Tallies values by type.
+class counting_visitor final : public data_visitor
+{
+ public:
+	using data_visitor::add_datum;
+
+	void add_datum(const path &, const empty_array &) override
+		{ ++empty_arrays; }
+
+	void add_datum(const path &, const empty_object &) override
+		{ ++empty_objects; }
+
+	void add_datum(const path &, std::nullptr_t) override { ++nulls; }
+
+	void add_datum(const path &, bool) override { ++booleans; }
+
+	void add_datum(const path &, int64_t) override { ++signed_integers; }
+
+	void add_datum(const path &, uint64_t) override { ++unsigned_integers; }
+
+	void add_datum(const path &, double) override { ++doubles; }
+
+	void add_datum(const path &, std::string && s) override
+	{
+		++strings;
+		string_bytes += s.size();
+	}
+
+	void add_datum(const path &, std::u32string && s) override
+	{
+		++strings;
+		string_bytes += s.size() * sizeof(char32_t);
+	}
+
+	void add_datum(const path &, big_number &&) override { ++big_numbers; }
+
+	uint64_t empty_arrays = 0;
+	uint64_t empty_objects = 0;
+	uint64_t nulls = 0;
+	uint64_t booleans = 0;
+	uint64_t signed_integers = 0;
+	uint64_t unsigned_integers = 0;
+	uint64_t doubles = 0;
+	uint64_t big_numbers = 0;
+	uint64_t strings = 0;
+	uint64_t string_bytes = 0;
+};
+
+class packed_array;
+
 struct value
 {
 	using string_type = std::string;
@@ -76,6 +183,7 @@ struct value
 	using array_ptr_type = std::shared_ptr<array_type>;
 	using object_type = std::unordered_map<std::string, value>;
 	using object_ptr_type = std::shared_ptr<object_type>;
+	using packed_array_ptr_type = std::shared_ptr<packed_array>;
 
 	value();
 
@@ -96,7 +204,9 @@ struct value
 	             std::nullptr_t,
 	             string_type,
 	             std::shared_ptr<array_type>,
-	             std::shared_ptr<object_type>> datum;
+	             std::shared_ptr<object_type>,
+	             big_number,
+	             std::shared_ptr<packed_array>> datum;
 
 	bool is_signed() const
 		{ return std::holds_alternative<int64_t>(datum); }
@@ -116,12 +226,20 @@ struct value
 	bool is_string() const
 		{ return std::holds_alternative<std::string>(datum); }
 
+	// Either kind of array, generic or packed
 	bool is_array() const
-		{ return std::holds_alternative<array_ptr_type>(datum); }
+		{ return std::holds_alternative<array_ptr_type>(datum)
+		      || std::holds_alternative<packed_array_ptr_type>(datum); }
+
+	bool is_packed_array() const
+		{ return std::holds_alternative<packed_array_ptr_type>(datum); }
 
 	bool is_object() const
 		{ return std::holds_alternative<object_ptr_type>(datum); }
 
+	bool is_big_number() const
+		{ return std::holds_alternative<big_number>(datum); }
+
 	object_ptr_type get_object() {
 		if ( ! is_object() )
 			throw std::runtime_error("get_object called on non-object datum");
@@ -129,13 +247,22 @@ struct value
 		return std::get<object_ptr_type>(datum);
 	}
 
-	array_ptr_type get_array() {
-		if ( ! is_array() )
-			throw std::runtime_error("get_object called on non-array datum");
+	// A packed array is unpacked into a generic one first, and stays so,
+	// in every value that shares it.
+	array_ptr_type get_array();
 
-		return std::get<array_ptr_type>(datum);
+	packed_array_ptr_type get_packed_array() {
+		if ( ! is_packed_array() )
+			throw std::runtime_error("get_packed_array called on non-packed datum");
+
+		return std::get<packed_array_ptr_type>(datum);
 	}
 
+	// Elements of either kind of array, without unpacking
+	size_t array_size() const;
+
+	value array_element(size_t i) const;
+
 	double get_double() {
 		if ( ! is_double() )
 			throw std::runtime_error("get_object called on non-double datum");
@@ -155,48 +282,166 @@ struct value
 	           bool indent_first = true) const;
 };
 
+// The elements of an array that are all int64_t, all uint64_t, all double
+// or all bool, stored contiguously rather than as a value each (bools one
+// bit each).  value_store builds arrays this way until an element of
+// another type arrives, and then unpacks them into a generic array.
+//
+// value::get_array() on a packed array held by several values unpacks it
+// here, once, so that all of them go on seeing the same elements.
+class packed_array
+{
+ public:
+	using elements_type = std::variant<std::vector<int64_t>,
+	                                   std::vector<uint64_t>,
+	                                   std::vector<double>,
+	                                   std::vector<bool>>;
+
+	packed_array(elements_type elements);
+
+	packed_array(const packed_array & other);
+
+	packed_array & operator = (const packed_array & other);
+
+	~packed_array();
+
+	// Only meaningful while the elements are still packed
+	const elements_type & elements() const { return data; }
+
+	template <typename T>
+	bool holds() const
+		{ return ! unpacked() && std::holds_alternative<std::vector<T>>(data); }
+
+	// For bulk consumers of int64_t, uint64_t and double elements; throws
+	// std::bad_variant_access if the elements are of another type.  Only
+	// meaningful while holds<T>().
+	template <typename T>
+	std::span<const T> span() const { return std::get<std::vector<T>>(data); }
+
+	// The generic array the elements were unpacked into, or nullptr
+	const value::array_type * unpacked() const
+		{ return generic_view.load(std::memory_order_acquire); }
+
+	// Unpacks the elements, if that hasn't happened yet, and returns the
+	// generic array they are in from then on.
+	value::array_ptr_type unpack_shared();
+
+	size_t size() const
+	{
+		if (auto a = unpacked())
+			return a->size();
+
+		return std::visit([](const auto & e) { return e.size(); }, data);
+	}
+
+	value at(size_t i) const;
+
+	value::array_type unpack() const;
+
+	// Calls f with each element, as its own type, or as a value once
+	// unpacked.
+	template <typename F>
+	void for_each(F && f) const
+	{
+		if (auto a = unpacked())
+			for (const value & element : *a)
+				f(element);
+		else
+			std::visit([&](const auto & e) { for (auto x : e) f(x); }, data);
+	}
+
+	// Appends datum if the elements are still packed and of its type.
+	template <typename T>
+	bool push_back(T datum)
+	{
+		auto elements = std::get_if<std::vector<T>>(&data);
+
+		if ( ! elements || unpacked())
+			return false;
+
+		elements->push_back(datum);
+		return true;
+	}
+
+ private:
+	elements_type data;
+	std::mutex generic_lock;
+	value::array_ptr_type generic;
+	// generic.get(), once it is set; it never changes after that
+	std::atomic<value::array_type *> generic_view;
+};
+
 class value_store : public value, public data_visitor
 {
  public:
+	using data_visitor::add_datum;
+
+	// An index this far or further past the end of an array throws
+	// limit_exceeded instead of filling the gap, so a path from untrusted
+	// input such as ".a.99999999999" can't allocate an array that large.
+	// The parsers only ever append.
+	uint64_t max_index_gap = 65536;
+
 	value * walk_path(const path & object_path)
+		{ return walk_path(object_path, object_path.size()); }
+
+	// Walks the first depth components of object_path.
+	value * walk_path(const path & object_path, size_t depth)
 	{
 		value * current = this;
 
-		for (const auto & p : object_path)
+		for (size_t i = 0; i < depth; ++i)
+			current = walk_step(current, object_path[i]);
+
+		return current;
+	}
+
+	// The member or element of current that p names, making current an
+	// object or array if it isn't the right one already.
+	value * walk_step(value * current, const path::value_type & p)
+	{
+		if (std::holds_alternative<std::string>(p))
 		{
-			if (std::holds_alternative<std::string>(p))
-			{
-				auto key = std::get<std::string>(p);
+			const auto & key = std::get<std::string>(p);
 
-				if ( ! std::holds_alternative<object_ptr_type>(current->datum)
-				   || std::get<object_ptr_type>(current->datum) == nullptr )
-					current->datum.emplace<object_ptr_type>(new object_type);
+			if ( ! std::holds_alternative<object_ptr_type>(current->datum)
+			   || std::get<object_ptr_type>(current->datum) == nullptr )
+				current->datum.emplace<object_ptr_type>(new object_type);
 
-				object_type & o = *std::get<object_ptr_type>(current->datum);
+			object_type & o = *std::get<object_ptr_type>(current->datum);
 
-				current = &o[key];
+			return &o[key];
 
-			} else if (std::holds_alternative<uint64_t>(p))
-			{
-				auto index = std::get<uint64_t>(p);
+		} else if (std::holds_alternative<uint64_t>(p))
+		{
+			auto index = std::get<uint64_t>(p);
+
+			array_type * a;
 
+			// An element that doesn't fit a packed array
+			if (current->is_packed_array())
+			{
+				a = current->get_array().get();
+			} else
+			{
 				if ( ! std::holds_alternative<array_ptr_type>(current->datum)
 				   || std::get<array_ptr_type>(current->datum) == nullptr )
 					current->datum.emplace<array_ptr_type>(new array_type);
 
-				array_type & a = *std::get<array_ptr_type>(current->datum);
+				a = std::get<array_ptr_type>(current->datum).get();
+			}
 
-				a.resize(index + 1);
+			if (index >= a->size() && index - a->size() >= max_index_gap)
+				throw limit_exceeded(limit::index_gap, max_index_gap);
 
-				current = &a[index];
+			a->resize(index + 1);
 
-			} else
-			{
-				throw std::runtime_error("path holds unknown type");
-			}
-		}
+			return &(*a)[index];
 
-		return current;
+		} else
+		{
+			throw std::runtime_error("path holds unknown type");
+		}
 	}
 
 	void add_datum(const path & object_path, const empty_array &) override
@@ -218,33 +463,57 @@ class value_store : public value, public data_visitor
 	}
 
 	void add_datum(const path & object_path, bool datum) override
-	{
-		value * current = walk_path(object_path);
-		current->datum = std::move(datum);
-	}
+		{ store_scalar(object_path, datum); }
 
 	void add_datum(const path & object_path, int64_t datum) override
-	{
-		value * current = walk_path(object_path);
-		current->datum = std::move(datum);
-	}
+		{ store_scalar(object_path, datum); }
 
 	void add_datum(const path & object_path, uint64_t datum) override
+		{ store_scalar(object_path, datum); }
+
+	void add_datum(const path & object_path, double datum) override
+		{ store_scalar(object_path, datum); }
+
+	void add_datum(const path & object_path, std::string && datum) override
 	{
 		value * current = walk_path(object_path);
 		current->datum = std::move(datum);
 	}
 
-	void add_datum(const path & object_path, double datum) override
+	void add_datum(const path & object_path, big_number && datum) override
 	{
 		value * current = walk_path(object_path);
 		current->datum = std::move(datum);
 	}
 
-	void add_datum(const path & object_path, std::string && datum) override
+ private:
+	// Array elements start or extend a packed array while they all have
+	// the same type.
+	template <typename T>
+	void store_scalar(const path & object_path, T datum)
 	{
-		value * current = walk_path(object_path);
-		current->datum = std::move(datum);
+		if ( ! object_path.empty()
+		   && std::holds_alternative<uint64_t>(object_path.back()))
+		{
+			value * parent = walk_path(object_path, object_path.size() - 1);
+			auto index = std::get<uint64_t>(object_path.back());
+
+			if (index == 0 && ! parent->is_array())
+			{
+				parent->datum = std::make_shared<packed_array>(
+					std::vector<T>(1, datum));
+				return;
+			}
+
+			if (parent->is_packed_array() && index == parent->array_size()
+			   && std::get<packed_array_ptr_type>(parent->datum)->push_back(datum))
+				return;
+
+			walk_step(parent, object_path.back())->datum = datum;
+			return;
+		}
+
+		walk_path(object_path)->datum = datum;
 	}
 };
 
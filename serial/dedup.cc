@@ -0,0 +1,223 @@
+#include "dedup.h"
+
+#include "diff.h"
+
+namespace serial {
+
+namespace {
+
+// Heap bytes held directly by a container, not counting its children's
+// containers
+size_t approximate_size(const value::array_type & a)
+{
+	return sizeof(a) + a.capacity() * sizeof(value);
+}
+
+size_t approximate_size(const value::object_type & o)
+{
+	size_t bytes = sizeof(o) + o.bucket_count() * sizeof(void *);
+
+	for (const auto & member : o)
+	{
+		// node: next pointer, cached hash, key and value
+		bytes += 2 * sizeof(void *) + sizeof(member);
+
+		if (member.first.capacity() > 15)
+			bytes += member.first.capacity() + 1;
+	}
+
+	return bytes;
+}
+
+} // namespace
+
+deduplicating_store::deduplicating_store()
+  : value_store()
+  , previous()
+  , open(1, this)
+  , hashes()
+  , arrays()
+  , objects()
+  , counters()
+	{ }
+
+value * deduplicating_store::enter(const path & object_path)
+{
+	size_t common = 0;
+
+	while (common < previous.size() && common < object_path.size()
+	       && previous[common] == object_path[common])
+		++common;
+
+	if (common < previous.size())
+		intern_completed(common);
+
+	open.resize(common + 1);
+
+	value * current = open.back();
+
+	for (size_t i = common; i < object_path.size(); ++i)
+	{
+		const auto & p = object_path[i];
+
+		if (std::holds_alternative<std::string>(p))
+		{
+			if ( ! current->is_object()
+			     || std::get<object_ptr_type>(current->datum) == nullptr)
+			{
+				current->datum.emplace<object_ptr_type>(new object_type);
+			} else if (std::get<object_ptr_type>(current->datum).use_count() > 1)
+			{
+				// Interned, so someone else may be sharing it
+				current->datum = std::make_shared<object_type>(
+					*std::get<object_ptr_type>(current->datum));
+			}
+
+			current = &(*std::get<object_ptr_type>(current->datum))[std::get<std::string>(p)];
+		} else
+		{
+			auto index = std::get<uint64_t>(p);
+
+			if ( ! std::holds_alternative<array_ptr_type>(current->datum)
+			     || std::get<array_ptr_type>(current->datum) == nullptr)
+			{
+				current->datum.emplace<array_ptr_type>(new array_type);
+			} else if (std::get<array_ptr_type>(current->datum).use_count() > 1)
+			{
+				current->datum = std::make_shared<array_type>(
+					*std::get<array_ptr_type>(current->datum));
+			}
+
+			array_type & a = *std::get<array_ptr_type>(current->datum);
+
+			if (index >= a.size() && index - a.size() >= max_index_gap)
+				throw limit_exceeded(limit::index_gap, max_index_gap);
+
+			a.resize(index + 1);
+
+			current = &a[index];
+		}
+
+		open.push_back(current);
+	}
+
+	previous = object_path;
+
+	return current;
+}
+
+void deduplicating_store::intern_completed(size_t depth)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// Deepest first, so children are already shared when their parent is
+	// hashed and compared
+	for (size_t k = open.size() - 1; k > depth; --k)
+		intern(*open[k]);
+
+	counters.overhead += std::chrono::steady_clock::now() - start;
+}
+
+void deduplicating_store::intern(value & node)
+{
+	if (std::holds_alternative<array_ptr_type>(node.datum)
+	    && std::get<array_ptr_type>(node.datum))
+	{
+		const auto & a = std::get<array_ptr_type>(node.datum);
+		++counters.containers;
+
+		auto [found, added] = arrays.try_emplace(hashes(node), a);
+
+		if (added || found->second == a)
+			return;
+
+		value canonical;
+		canonical.datum = found->second;
+
+		if ( ! equal(node, canonical))
+			return;
+
+		counters.bytes_saved += approximate_size(*a);
+		++counters.shared;
+		hashes.forget(node);
+		node.datum = found->second;
+	} else if (node.is_object() && std::get<object_ptr_type>(node.datum))
+	{
+		const auto & o = std::get<object_ptr_type>(node.datum);
+		++counters.containers;
+
+		auto [found, added] = objects.try_emplace(hashes(node), o);
+
+		if (added || found->second == o)
+			return;
+
+		value canonical;
+		canonical.datum = found->second;
+
+		if ( ! equal(node, canonical))
+			return;
+
+		counters.bytes_saved += approximate_size(*o);
+		++counters.shared;
+		hashes.forget(node);
+		node.datum = found->second;
+	}
+}
+
+void deduplicating_store::finish()
+{
+	intern_completed(0);
+
+	previous.clear();
+	open.assign(1, this);
+	hashes.clear();
+	arrays.clear();
+	objects.clear();
+}
+
+void deduplicating_store::add_datum(const path & object_path, const empty_array &)
+{
+	enter(object_path)->datum.emplace<array_ptr_type>(new array_type);
+}
+
+void deduplicating_store::add_datum(const path & object_path, const empty_object &)
+{
+	enter(object_path)->datum.emplace<object_ptr_type>(new object_type);
+}
+
+void deduplicating_store::add_datum(const path & object_path, std::nullptr_t)
+{
+	enter(object_path)->datum = nullptr;
+}
+
+void deduplicating_store::add_datum(const path & object_path, bool datum)
+{
+	enter(object_path)->datum = datum;
+}
+
+void deduplicating_store::add_datum(const path & object_path, int64_t datum)
+{
+	enter(object_path)->datum = datum;
+}
+
+void deduplicating_store::add_datum(const path & object_path, uint64_t datum)
+{
+	enter(object_path)->datum = datum;
+}
+
+void deduplicating_store::add_datum(const path & object_path, double datum)
+{
+	enter(object_path)->datum = datum;
+}
+
+void deduplicating_store::add_datum(const path & object_path, std::string && datum)
+{
+	enter(object_path)->datum = std::move(datum);
+}
+
+void deduplicating_store::add_datum(const path & object_path, big_number && datum)
+{
+	enter(object_path)->datum = std::move(datum);
+}
+
+} // namespace serial
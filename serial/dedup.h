@@ -0,0 +1,84 @@
+#ifndef SERIAL_DEDUP_H
+#define SERIAL_DEDUP_H 1
+
+#include <chrono>
+#include <unordered_map>
+
+#include "data_visitor.h"
+#include "hash.h"
+
+namespace serial {
+
+struct dedup_stats
+{
+	// Arrays and objects completed during the parse
+	uint64_t containers = 0;
+	// ... of which were replaced by an identical earlier one
+	uint64_t shared = 0;
+	// Approximate heap bytes released by sharing
+	uint64_t bytes_saved = 0;
+	// Time spent hashing and interning
+	std::chrono::nanoseconds overhead{0};
+};
+
+// A value_store that shares identical subtrees.  Each array or object is
+// interned as soon as the parser moves past it, by content hash, so later
+// copies point at the first one's container.  Only containers are
+// shared: strings live inside a value, and short ones fit in the small
+// string buffer anyway.
+//
+// A shared container is never modified: if input with duplicate keys
+// re-enters a subtree that was already interned, the containers on the way
+// are copied first.
+class deduplicating_store : public value_store
+{
+ public:
+	deduplicating_store();
+
+	using value_store::add_datum;
+
+	void add_datum(const path & object_path, const empty_array &) override;
+
+	void add_datum(const path & object_path, const empty_object &) override;
+
+	void add_datum(const path & object_path, std::nullptr_t) override;
+
+	void add_datum(const path & object_path, bool datum) override;
+
+	void add_datum(const path & object_path, int64_t datum) override;
+
+	void add_datum(const path & object_path, uint64_t datum) override;
+
+	void add_datum(const path & object_path, double datum) override;
+
+	void add_datum(const path & object_path, std::string && datum) override;
+
+	void add_datum(const path & object_path, big_number && datum) override;
+
+	// Interns the subtrees still open at the end of the input and frees
+	// the interning tables; call once parsing is done.
+	void finish();
+
+	const dedup_stats & stats() const { return counters; }
+
+ private:
+	// Interns what the previous path completed, then walks to object_path,
+	// copying shared containers on the way.
+	value * enter(const path & object_path);
+
+	void intern_completed(size_t depth);
+
+	void intern(value & node);
+
+	path previous;
+	// open[i] is the node at previous[0..i)
+	std::vector<value *> open;
+	hash_cache hashes;
+	std::unordered_map<digest, value::array_ptr_type> arrays;
+	std::unordered_map<digest, value::object_ptr_type> objects;
+	dedup_stats counters;
+};
+
+} // namespace serial
+
+#endif // SERIAL_DEDUP_H
@@ -0,0 +1,390 @@
+#include "diff.h"
+
+#include <algorithm>
+#include <ostream>
+#include <unordered_map>
+
+#include "hash.h"
+#include "pointer.h"
+
+namespace serial {
+
+namespace {
+
+bool same_container(const value & a, const value & b)
+{
+	if (std::holds_alternative<value::object_ptr_type>(a.datum)
+	    && std::holds_alternative<value::object_ptr_type>(b.datum))
+		return std::get<value::object_ptr_type>(a.datum)
+		       == std::get<value::object_ptr_type>(b.datum);
+
+	if (std::holds_alternative<value::array_ptr_type>(a.datum)
+	    && std::holds_alternative<value::array_ptr_type>(b.datum))
+		return std::get<value::array_ptr_type>(a.datum)
+		       == std::get<value::array_ptr_type>(b.datum);
+
+	if (a.is_packed_array() && b.is_packed_array())
+		return std::get<value::packed_array_ptr_type>(a.datum)
+		       == std::get<value::packed_array_ptr_type>(b.datum);
+
+	return false;
+}
+
+// The elements of either kind of array; a packed one is unpacked into
+// scratch.
+const value::array_type & elements_of(const value & v,
+                                      value::array_type & scratch)
+{
+	static const value::array_type none;
+
+	if (v.is_packed_array())
+	{
+		const auto & a = std::get<value::packed_array_ptr_type>(v.datum);
+
+		if (auto unpacked = a->unpacked())
+			return *unpacked;
+
+		scratch = a->unpack();
+		return scratch;
+	}
+
+	const auto & a = std::get<value::array_ptr_type>(v.datum);
+	return a ? *a : none;
+}
+
+class differ
+{
+ public:
+	differ(const patch_callback & e, hash_cache & h)
+	  : emit(e)
+	  , hashes(h)
+	  , where()
+		{ }
+
+	void compare(const value & from, const value & to);
+
+ private:
+	void report(patch_op op, const value & datum)
+		{ emit(patch_operation{op, where, datum}); }
+
+	void compare_objects(const value::object_type & from,
+	                     const value::object_type & to);
+
+	void compare_arrays(const value::array_type & from,
+	                    const value::array_type & to);
+
+	const patch_callback & emit;
+	hash_cache & hashes;
+	path where;
+};
+
+void differ::compare(const value & from, const value & to)
+{
+	if (same_container(from, to) || hashes.same(from, to))
+		return;
+
+	if (std::holds_alternative<value::object_ptr_type>(from.datum)
+	    && std::holds_alternative<value::object_ptr_type>(to.datum))
+	{
+		static const value::object_type none;
+		const auto & a = std::get<value::object_ptr_type>(from.datum);
+		const auto & b = std::get<value::object_ptr_type>(to.datum);
+
+		compare_objects(a ? *a : none, b ? *b : none);
+	} else if (from.is_array() && to.is_array())
+	{
+		value::array_type from_scratch, to_scratch;
+
+		compare_arrays(elements_of(from, from_scratch),
+		               elements_of(to, to_scratch));
+	} else
+	{
+		report(patch_op::replace, to);
+	}
+}
+
+void differ::compare_objects(const value::object_type & from,
+                             const value::object_type & to)
+{
+	for (const auto & [key, member] : from)
+	{
+		where.emplace_back(key);
+
+		auto found = to.find(key);
+
+		if (found == to.end())
+			report(patch_op::remove, value());
+		else
+			compare(member, found->second);
+
+		where.pop_back();
+	}
+
+	for (const auto & [key, member] : to)
+	{
+		if (from.count(key))
+			continue;
+
+		where.emplace_back(key);
+		report(patch_op::add, member);
+		where.pop_back();
+	}
+}
+
+void differ::compare_arrays(const value::array_type & from,
+                            const value::array_type & to)
+{
+	size_t prefix = 0;
+	size_t limit = std::min(from.size(), to.size());
+
+	while (prefix < limit && hashes.same(from[prefix], to[prefix]))
+		++prefix;
+
+	size_t suffix = 0;
+
+	while (suffix < limit - prefix
+	       && hashes.same(from[from.size() - 1 - suffix],
+	                      to[to.size() - 1 - suffix]))
+		++suffix;
+
+	size_t from_end = from.size() - suffix;
+	size_t to_end = to.size() - suffix;
+
+	// How often each element's hash occurs in what is left of each side
+	std::vector<digest> from_hash, to_hash;
+	std::unordered_map<digest, size_t> from_rest, to_rest;
+
+	from_hash.reserve(from_end - prefix);
+	to_hash.reserve(to_end - prefix);
+	from_rest.reserve(from_end - prefix);
+	to_rest.reserve(to_end - prefix);
+
+	for (size_t i = prefix; i < from_end; ++i)
+		++from_rest[from_hash.emplace_back(hashes(from[i]))];
+
+	for (size_t j = prefix; j < to_end; ++j)
+		++to_rest[to_hash.emplace_back(hashes(to[j]))];
+
+	// Indices are reported as of the array at that point in the patch:
+	// position counts the elements already settled.
+	size_t i = prefix, j = prefix, position = prefix;
+
+	while (i < from_end || j < to_end)
+	{
+		digest removed = i < from_end ? from_hash[i - prefix] : digest();
+		digest added = j < to_end ? to_hash[j - prefix] : digest();
+		if (i < from_end && j < to_end && removed == added)
+		{
+			--from_rest[removed];
+			--to_rest[added];
+			++i;
+			++j;
+			++position;
+			continue;
+		}
+
+		bool keep_from = i < from_end && to_rest[removed] > 0;
+		bool keep_to = j < to_end && from_rest[added] > 0;
+
+		where.emplace_back(uint64_t(position));
+
+		if (i < from_end && (j == to_end || ( ! keep_from && keep_to)))
+		{
+			// from[i] has no counterpart later on
+			report(patch_op::remove, value());
+			--from_rest[removed];
+			++i;
+		} else if (i == from_end || (keep_from && ! keep_to))
+		{
+			// to[j] is new
+			report(patch_op::add, to[j]);
+			--to_rest[added];
+			++j;
+			++position;
+		} else
+		{
+			// Changed in place
+			compare(from[i], to[j]);
+			--from_rest[removed];
+			--to_rest[added];
+			++i;
+			++j;
+			++position;
+		}
+
+		where.pop_back();
+	}
+}
+
+} // namespace
+
+const char * to_string(patch_op op)
+{
+	switch (op)
+	{
+	 case patch_op::add: return "add";
+	 case patch_op::remove: return "remove";
+	 case patch_op::replace: return "replace";
+	}
+
+	return "unknown";
+}
+
+std::string patch_operation::pointer() const
+{
+	return to_pointer(where);
+}
+
+bool equal(const value & a, const value & b)
+{
+	if (same_container(a, b))
+		return true;
+
+	if (a.is_signed() && b.is_unsigned())
+		return std::get<int64_t>(a.datum) >= 0
+		    && uint64_t(std::get<int64_t>(a.datum)) == std::get<uint64_t>(b.datum);
+
+	if (a.is_unsigned() && b.is_signed())
+		return equal(b, a);
+
+	if (a.is_packed_array() && b.is_packed_array())
+	{
+		const auto & x = *std::get<value::packed_array_ptr_type>(a.datum);
+		const auto & y = *std::get<value::packed_array_ptr_type>(b.datum);
+
+		if ( ! x.unpacked() && ! y.unpacked()
+		   && x.elements().index() == y.elements().index())
+			return x.elements() == y.elements();
+	}
+
+	// Element by element when packed and generic arrays meet, or packed
+	// ones of different types (int64 and uint64 may still be equal)
+	if ((a.is_packed_array() || b.is_packed_array())
+	   && a.is_array() && b.is_array())
+	{
+		size_t n = a.array_size();
+
+		if (n != b.array_size())
+			return false;
+
+		for (size_t i = 0; i < n; ++i)
+			if ( ! equal(a.array_element(i), b.array_element(i)))
+				return false;
+
+		return true;
+	}
+
+	if (a.datum.index() != b.datum.index())
+		return false;
+
+	if (a.is_object())
+	{
+		const auto & x = std::get<value::object_ptr_type>(a.datum);
+		const auto & y = std::get<value::object_ptr_type>(b.datum);
+		size_t x_size = x ? x->size() : 0;
+		size_t y_size = y ? y->size() : 0;
+
+		if (x_size != y_size)
+			return false;
+
+		if (x_size == 0)
+			return true;
+
+		for (const auto & [key, member] : *x)
+		{
+			auto found = y->find(key);
+
+			if (found == y->end() || ! equal(member, found->second))
+				return false;
+		}
+
+		return true;
+	}
+
+	if (a.is_array())
+	{
+		const auto & x = std::get<value::array_ptr_type>(a.datum);
+		const auto & y = std::get<value::array_ptr_type>(b.datum);
+		size_t x_size = x ? x->size() : 0;
+		size_t y_size = y ? y->size() : 0;
+
+		if (x_size != y_size)
+			return false;
+
+		for (size_t i = 0; i < x_size; ++i)
+			if ( ! equal((*x)[i], (*y)[i]))
+				return false;
+
+		return true;
+	}
+
+	return a.datum == b.datum;
+}
+
+void diff(const value & from, const value & to, const patch_callback & emit)
+{
+	hash_cache hashes;
+	diff(from, to, emit, hashes);
+}
+
+void diff(const value & from, const value & to, const patch_callback & emit,
+          hash_cache & hashes)
+{
+	differ(emit, hashes).compare(from, to);
+}
+
+std::vector<patch_operation> diff(const value & from, const value & to)
+{
+	std::vector<patch_operation> ops;
+
+	diff(from, to, [&](const patch_operation & op) { ops.push_back(op); });
+
+	return ops;
+}
+
+snapshot apply_patch(const snapshot & doc,
+                     const std::vector<patch_operation> & ops)
+{
+	snapshot result = doc;
+
+	for (const auto & op : ops)
+	{
+		auto p = pointer::from_path(op.where);
+
+		switch (op.op)
+		{
+		 case patch_op::add: result = result.inserted(p, op.datum); break;
+		 case patch_op::remove: result = result.without(p); break;
+		 case patch_op::replace: result = result.with(p, op.datum); break;
+		}
+	}
+
+	return result;
+}
+
+void write_patch(std::ostream & out, const std::vector<patch_operation> & ops)
+{
+	out << '[';
+
+	for (size_t i = 0; i < ops.size(); ++i)
+	{
+		value path_string;
+		path_string.datum = ops[i].pointer();
+
+		out << (i ? ",\n\t" : "\n\t") << "{ \"op\": \"" << to_string(ops[i].op)
+		    << "\", \"path\": ";
+		path_string.print(out, 1, false);
+
+		if (ops[i].op != patch_op::remove)
+		{
+			out << ", \"value\": ";
+			ops[i].datum.print(out, 1, false);
+		}
+
+		out << " }";
+	}
+
+	out << (ops.empty() ? "]\n" : "\n]\n");
+}
+
+} // namespace serial
@@ -0,0 +1,64 @@
+#ifndef SERIAL_DIFF_H
+#define SERIAL_DIFF_H 1
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "data_visitor.h"
+#include "snapshot.h"
+
+namespace serial {
+
+class hash_cache;
+
+enum class patch_op
+{
+	add,
+	remove,
+	replace,
+};
+
+const char * to_string(patch_op op);
+
+// One RFC 6902 operation; datum is unused for remove.
+struct patch_operation
+{
+	patch_op op;
+	path where;
+	value datum;
+
+	std::string pointer() const;
+};
+
+using patch_callback = std::function<void(const patch_operation &)>;
+
+// Deep equality.  Containers shared between the two trees compare equal
+// without being walked, and int64/uint64 compare by numeric value.
+bool equal(const value & a, const value & b);
+
+// Reports the operations that turn from into to, in an order in which
+// they can be applied one after another.  Subtrees are compared by content
+// hash.  Array elements are matched by hash after trimming the common
+// prefix and suffix, so an insertion or removal anywhere yields a single
+// operation rather than a cascade of replacements.
+void diff(const value & from, const value & to, const patch_callback & emit);
+
+// Keeps the subtree hashes in a cache that outlives the call, e.g. to diff
+// each new snapshot of a document against the previous one.
+void diff(const value & from, const value & to, const patch_callback & emit,
+          hash_cache & hashes);
+
+std::vector<patch_operation> diff(const value & from, const value & to);
+
+// Applies the operations in order, sharing unchanged subtrees with doc.
+snapshot apply_patch(const snapshot & doc,
+                     const std::vector<patch_operation> & ops);
+
+// Writes the operations as a JSON Patch document.
+void write_patch(std::ostream & out, const std::vector<patch_operation> & ops);
+
+} // namespace serial
+
+#endif // SERIAL_DIFF_H
@@ -0,0 +1,273 @@
+#include "file_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "util/error_handling.h"
+#include "util/file_descriptor.h"
+
+namespace serial {
+
+namespace {
+
+class mapping
+{
+ public:
+	mapping(void * address, size_t size) : address(address), size(size) { }
+
+	mapping(const mapping &) = delete;
+
+	mapping & operator = (const mapping &) = delete;
+
+	~mapping() { if (address != MAP_FAILED) munmap(address, size); }
+
+	bool failed() const { return address == MAP_FAILED; }
+
+	char * data() const { return static_cast<char *>(address); }
+
+ private:
+	void * address;
+	size_t size;
+};
+
+void read_all(int fd, char * buffer, size_t & n, const stdfs::path & filename)
+{
+	size_t done = 0;
+
+	while (done < n)
+	{
+		ssize_t rc = read(fd, buffer + done, n - done);
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			util::throw_errno("Could not read file '%s'", filename.c_str());
+		}
+
+		if (rc == 0)
+			break;
+
+		done += rc;
+	}
+
+	n = done;
+}
+
+// One read(), retried if a signal interrupts it; 0 at the end of input
+size_t read_some(int fd, char * buffer, size_t n, const stdfs::path & filename)
+{
+	for (;;)
+	{
+		ssize_t rc = read(fd, buffer, n);
+
+		if (rc >= 0)
+			return rc;
+
+		if (errno != EINTR)
+			util::throw_errno("Could not read file '%s'", filename.c_str());
+	}
+}
+
+void read_stream(int fd, const stdfs::path & filename,
+                 const data_sink & sink, read_stats & stats)
+{
+	static constexpr size_t bufsz = 16384;
+	char buffer[bufsz];
+	size_t filled = 0;
+	size_t n = 0;
+
+	// Gather enough of the stream to recognize a compression header
+	while (filled < 4
+	       && (n = read_some(fd, buffer + filled, bufsz - filled, filename)) > 0)
+		filled += n;
+
+	stats.compression = util::detect_compression(buffer, filled);
+	stats.file_bytes = filled;
+
+	if (stats.compression != util::compression::none)
+	{
+		// The rest of the input is consumed by the decompression thread
+		stats.file_bytes = 0;
+
+		util::decompressing_reader in(stats.compression, buffer, filled, fd);
+		const char * chunk = nullptr;
+
+		while ((n = in.next(chunk)) > 0)
+		{
+			stats.data_bytes += n;
+			sink(chunk, n, false);
+		}
+
+		return;
+	}
+
+	if (filled > 0)
+	{
+		stats.data_bytes += filled;
+		sink(buffer, filled, false);
+	}
+
+	while ((n = read_some(fd, buffer, bufsz, filename)) > 0)
+	{
+		stats.file_bytes += n;
+		stats.data_bytes += n;
+		sink(buffer, n, false);
+	}
+}
+
+} // anonymous namespace
+
+const char * to_string(read_strategy strategy)
+{
+	switch (strategy)
+	{
+	 case read_strategy::automatic: return "automatic";
+	 case read_strategy::read: return "read";
+	 case read_strategy::mmap: return "mmap";
+	 case read_strategy::mmap_sequential: return "mmap_sequential";
+	 case read_strategy::mmap_populate: return "mmap_populate";
+	 case read_strategy::huge_page_buffer: return "huge_page_buffer";
+	 case read_strategy::stream: return "stream";
+	}
+
+	return "unknown";
+}
+
+read_stats read_file(const stdfs::path & filename,
+                     const read_options & options,
+                     const data_sink & sink)
+{
+	util::file_descriptor fd = (
+		filename == "-" ? dup(0) : open(filename.c_str(), O_RDONLY) );
+
+	if (fd < 0)
+		util::throw_errno("Could not open file '%s'", filename.c_str());
+
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		util::throw_errno("Could not stat file '%s'", filename.c_str());
+
+	size_t size = st.st_size;
+	read_stats stats;
+	stats.strategy = options.strategy;
+
+	if ( ! S_ISREG(st.st_mode) || size == 0)
+		stats.strategy = read_strategy::stream;
+	else if (stats.strategy == read_strategy::automatic)
+		stats.strategy = size <= options.small_file_limit
+		               ? read_strategy::read
+		               : read_strategy::mmap;
+
+	switch (stats.strategy)
+	{
+	 case read_strategy::mmap:
+	 case read_strategy::mmap_sequential:
+	 case read_strategy::mmap_populate:
+	 {
+		int flags = MAP_SHARED;
+
+		if (stats.strategy == read_strategy::mmap_populate)
+			flags |= MAP_POPULATE;
+
+		mapping m(mmap(nullptr, size, PROT_READ, flags, fd, 0), size);
+
+		if (m.failed())
+		{
+			stats.strategy = read_strategy::stream;
+			break;
+		}
+
+		if (stats.strategy == read_strategy::mmap_sequential)
+		{
+			madvise(m.data(), size, MADV_SEQUENTIAL);
+			madvise(m.data(), size, MADV_WILLNEED);
+		}
+
+		read_buffer(m.data(), size, sink, &stats);
+		return stats;
+	 }
+
+	 case read_strategy::huge_page_buffer:
+	 {
+		static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+		size_t capacity = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+
+		mapping m(mmap(nullptr, capacity, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0),
+		          capacity);
+
+		if (m.failed())
+			util::throw_errno("Could not allocate %zu byte buffer", capacity);
+
+		// Best effort; without THP this is an ordinary buffer
+		madvise(m.data(), capacity, MADV_HUGEPAGE);
+
+		read_all(fd, m.data(), size, filename);
+		read_buffer(m.data(), size, sink, &stats);
+		return stats;
+	 }
+
+	 case read_strategy::read:
+	 {
+		std::unique_ptr<char[]> buffer(new char[size]);
+
+		read_all(fd, buffer.get(), size, filename);
+		read_buffer(buffer.get(), size, sink, &stats);
+		return stats;
+	 }
+
+	 default:
+		break;
+	}
+
+	read_stream(fd, filename, sink, stats);
+
+	if (S_ISREG(st.st_mode))
+		stats.file_bytes = size;
+
+	return stats;
+}
+
+void read_buffer(const char * buffer, size_t n,
+                 const data_sink & sink,
+                 read_stats * stats)
+{
+	util::compression type = util::detect_compression(buffer, n);
+
+	if (stats)
+	{
+		stats->compression = type;
+		stats->file_bytes = n;
+	}
+
+	if (type == util::compression::none)
+	{
+		if (stats)
+			stats->data_bytes = n;
+
+		sink(buffer, n, true);
+		return;
+	}
+
+	util::decompressing_reader in(type, buffer, n);
+	const char * chunk = nullptr;
+	size_t chunk_n;
+
+	while ((chunk_n = in.next(chunk)) > 0)
+	{
+		if (stats)
+			stats->data_bytes += chunk_n;
+
+		sink(chunk, chunk_n, false);
+	}
+}
+
+} // namespace serial
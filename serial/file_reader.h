@@ -0,0 +1,76 @@
+#ifndef SERIAL_FILE_READER_H
+#define SERIAL_FILE_READER_H 1
+
+#include <cstddef>
+#include <cstdint>
+
+#include <filesystem>
+#include <functional>
+
+#include "util/compressed_stream.h"
+
+namespace serial {
+
+namespace stdfs = std::filesystem;
+
+enum class read_strategy
+{
+	// read below small_file_limit, mmap above it, and stream for
+	// anything that is not a regular file
+	automatic,
+	// a single read() of the whole file into a heap buffer
+	read,
+	// plain shared mapping of the file
+	mmap,
+	// mapping with MADV_SEQUENTIAL | MADV_WILLNEED, so the kernel reads
+	// ahead aggressively and drops pages behind the parser
+	mmap_sequential,
+	// mapping with MAP_POPULATE, taking all page faults up front
+	mmap_populate,
+	// read() into an anonymous buffer backed by transparent huge pages
+	huge_page_buffer,
+	// fixed-size read() calls, for pipes and the like
+	stream,
+};
+
+const char * to_string(read_strategy strategy);
+
+struct read_options
+{
+	read_strategy strategy = read_strategy::automatic;
+
+	// With the automatic strategy, files up to this size skip mmap and
+	// are read with one read() call.
+	size_t small_file_limit = 128 * 1024;
+};
+
+struct read_stats
+{
+	read_strategy strategy = read_strategy::automatic;
+	util::compression compression = util::compression::none;
+	// Size of the file as stored (0 if unknown, e.g. for a compressed
+	// pipe), and of the data handed to the sink
+	uint64_t file_bytes = 0;
+	uint64_t data_bytes = 0;
+};
+
+// whole is set when the call hands over the entire input at once, so the
+// sink can use it in place instead of collecting chunks.
+using data_sink = std::function<void(const char * data, size_t n, bool whole)>;
+
+// Loads a file ("-" for standard input) with the requested strategy and
+// hands its contents to sink, in one piece or in chunks.  gzip and zstd
+// input is decompressed on a separate thread and delivered in chunks.
+// Uncompressed input is delivered whole unless it is streamed.
+read_stats read_file(const stdfs::path & filename,
+                     const read_options & options,
+                     const data_sink & sink);
+
+// Hands an in-memory document to sink, decompressing it if needed.
+void read_buffer(const char * buffer, size_t n,
+                 const data_sink & sink,
+                 read_stats * stats = nullptr);
+
+} // namespace serial
+
+#endif // SERIAL_FILE_READER_H
@@ -0,0 +1,515 @@
+#include "flatten.h"
+
+#include <fnmatch.h>
+
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+
+#include "util/utf8.h"
+#include "writer.h"
+
+namespace serial {
+
+namespace {
+
+bool needs_quotes(std::string_view key)
+{
+	if (key.empty())
+		return true;
+
+	bool digits = true;
+
+	for (unsigned char c : key)
+	{
+		if (c == '.' || c == '"' || c == '\\' || c == ' ' || c < 0x20 || c == 0x7f)
+			return true;
+
+		digits = digits && c >= '0' && c <= '9';
+	}
+
+	// It would read back as an array index
+	return digits;
+}
+
+unsigned hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	throw std::runtime_error("bad \\u escape");
+}
+
+char32_t read_hex4(std::string_view & s)
+{
+	if (s.size() < 4)
+		throw std::runtime_error("bad \\u escape");
+
+	char32_t c = 0;
+
+	for (int i = 0; i < 4; ++i)
+		c = c << 4 | hex_digit(s[i]);
+
+	s.remove_prefix(4);
+	return c;
+}
+
+// A JSON string at the start of s, which must start with '"'
+void read_quoted(std::string_view & s, std::string & out)
+{
+	out.clear();
+	s.remove_prefix(1);
+
+	for (;;)
+	{
+		size_t n = s.find_first_of("\"\\");
+
+		if (n == std::string_view::npos)
+			throw std::runtime_error("unterminated string");
+
+		out.append(s.data(), n);
+		char c = s[n];
+		s.remove_prefix(n + 1);
+
+		if (c == '"')
+			return;
+
+		if (s.empty())
+			throw std::runtime_error("unterminated string");
+
+		c = s[0];
+		s.remove_prefix(1);
+
+		switch (c)
+		{
+		 case '"': out.push_back('"'); break;
+		 case '\\': out.push_back('\\'); break;
+		 case '/': out.push_back('/'); break;
+		 case 'b': out.push_back('\b'); break;
+		 case 'f': out.push_back('\f'); break;
+		 case 'n': out.push_back('\n'); break;
+		 case 'r': out.push_back('\r'); break;
+		 case 't': out.push_back('\t'); break;
+		 case 'u':
+		 {
+			char32_t codepoint = read_hex4(s);
+
+			if (codepoint >= 0xd800 && codepoint < 0xdc00
+			   && s.size() >= 2 && s[0] == '\\' && s[1] == 'u')
+			{
+				std::string_view rest = s.substr(2);
+				char32_t low = read_hex4(rest);
+
+				if (low >= 0xdc00 && low < 0xe000)
+				{
+					codepoint = 0x10000 + ((codepoint - 0xd800) << 10)
+					          + (low - 0xdc00);
+					s = rest;
+				}
+			}
+
+			util::to_utf8(codepoint, out);
+			break;
+		 }
+		 default:
+			throw std::runtime_error(std::string("bad escape '\\") + c + "'");
+		}
+	}
+}
+
+template <typename T>
+bool read_number(std::string_view s, T & n)
+{
+	auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), n);
+
+	if (error == std::errc::result_out_of_range && end == s.data() + s.size())
+		return false;
+
+	if (error != std::errc() || end != s.data() + s.size())
+		throw std::runtime_error("bad value '" + std::string(s) + "'");
+
+	return true;
+}
+
+} // namespace
+
+void append_path_component(std::string & out,
+                           const std::variant<std::string, uint64_t> & c)
+{
+	out.push_back('.');
+
+	if (const uint64_t * index = std::get_if<uint64_t>(&c))
+	{
+		append_number(out, *index);
+		return;
+	}
+
+	const std::string & key = std::get<std::string>(c);
+
+	if (needs_quotes(key))
+		append_quoted(out, key);
+	else
+		out += key;
+}
+
+//////////////////////////////////////////////////////////////////////
+flattening_visitor::flattening_visitor(const output & o,
+                                       const flatten_options & opts)
+  : data_visitor()
+  , out(o)
+  , options(opts)
+  , buffer()
+  , line_prefix()
+  , path_text()
+  , component_ends()
+  , last_path()
+{
+	buffer.reserve(options.buffer_size + 1024);
+}
+
+flattening_visitor::~flattening_visitor()
+{
+	try
+	{
+		flush();
+	} catch (...)
+	{
+	}
+}
+
+void flattening_visitor::set_prefix(std::string_view prefix)
+{
+	line_prefix = prefix;
+}
+
+void flattening_visitor::flush()
+{
+	if (buffer.empty())
+		return;
+
+	out(buffer);
+	buffer.clear();
+}
+
+bool flattening_visitor::begin_line(const path & p)
+{
+	size_t common = 0;
+
+	while (common < last_path.size() && common < p.size()
+	       && last_path[common] == p[common])
+		++common;
+
+	path_text.resize(common ? component_ends[common - 1] : 0);
+	component_ends.resize(common);
+	// Assigned in place, so key strings keep their capacity
+	last_path.resize(p.size());
+
+	for (size_t i = common; i < p.size(); ++i)
+	{
+		append_path_component(path_text, p[i]);
+		component_ends.push_back(path_text.size());
+		last_path[i] = p[i];
+	}
+
+	if ( ! options.filters.empty())
+	{
+		bool match = false;
+
+		for (const auto & f : options.filters)
+			if (fnmatch(f.c_str(), path_text.c_str(), 0) == 0)
+			{
+				match = true;
+				break;
+			}
+
+		if ( ! match)
+			return false;
+	}
+
+	buffer += line_prefix;
+	buffer += path_text;
+	buffer += " -> ";
+	return true;
+}
+
+void flattening_visitor::add_datum(const path & p, const empty_array &)
+{
+	if ( ! begin_line(p))
+		return;
+
+	buffer += "[ ]";
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, const empty_object &)
+{
+	if ( ! begin_line(p))
+		return;
+
+	buffer += "{ }";
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, std::nullptr_t)
+{
+	if ( ! begin_line(p))
+		return;
+
+	buffer += "null";
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, bool datum)
+{
+	if ( ! begin_line(p))
+		return;
+
+	buffer += datum ? "true" : "false";
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, int64_t datum)
+{
+	if ( ! begin_line(p))
+		return;
+
+	append_number(buffer, datum);
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, uint64_t datum)
+{
+	if ( ! begin_line(p))
+		return;
+
+	append_number(buffer, datum);
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, double datum)
+{
+	if ( ! begin_line(p))
+		return;
+
+	size_t start = buffer.size();
+
+	// append_number() writes -0.0 as 0, which would lose the sign
+	if (datum == 0 && std::signbit(datum))
+		buffer.push_back('-');
+
+	append_number(buffer, datum);
+
+	// So that it reads back as a double rather than an integer
+	if (buffer.find_first_of(".e", start) == std::string::npos)
+		buffer += ".0";
+
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, std::string && datum)
+{
+	if ( ! begin_line(p))
+		return;
+
+	append_quoted(buffer, datum);
+	end_line();
+}
+
+void flattening_visitor::add_datum(const path & p, big_number && datum)
+{
+	if ( ! begin_line(p))
+		return;
+
+	buffer += datum.text;
+	end_line();
+}
+
+//////////////////////////////////////////////////////////////////////
+unflattener::unflattener(data_visitor & d)
+  : data(d)
+  , object_path()
+  , partial()
+  , token()
+  , line_number(0)
+	{ }
+
+void unflattener::add(std::string_view text)
+{
+	size_t start = 0;
+
+	if ( ! partial.empty())
+	{
+		size_t newline = text.find('\n');
+
+		if (newline == std::string_view::npos)
+		{
+			partial.append(text);
+			return;
+		}
+
+		partial.append(text.substr(0, newline));
+		line(partial);
+		partial.clear();
+		start = newline + 1;
+	}
+
+	for (size_t newline; (newline = text.find('\n', start)) != std::string_view::npos;
+	     start = newline + 1)
+		line(text.substr(start, newline - start));
+
+	partial.assign(text.substr(start));
+}
+
+void unflattener::finish()
+{
+	if ( ! partial.empty())
+		line(partial);
+
+	partial.clear();
+}
+
+void unflattener::line(std::string_view text)
+{
+	++line_number;
+
+	if ( ! text.empty() && text.back() == '\r')
+		text.remove_suffix(1);
+
+	if (text.empty())
+		return;
+
+	try
+	{
+		size_t depth = 0;
+
+		while ( ! text.empty() && text[0] == '.')
+		{
+			text.remove_prefix(1);
+
+			if (depth == object_path.size())
+				object_path.emplace_back(std::string());
+
+			auto & component = object_path[depth++];
+
+			if ( ! text.empty() && text[0] == '"')
+			{
+				read_quoted(text, token);
+
+				if (std::string * key = std::get_if<std::string>(&component))
+					key->assign(token);
+				else
+					component = token;
+
+				continue;
+			}
+
+			std::string_view name = text.substr(0, text.find_first_of(". "));
+			text.remove_prefix(name.size());
+
+			if (name.empty())
+				throw std::runtime_error("empty path component");
+
+			uint64_t index;
+
+			if (name.find_first_not_of("0123456789") == std::string_view::npos
+			   && read_number(name, index))
+				component = index;
+			else if (std::string * key = std::get_if<std::string>(&component))
+				key->assign(name);
+			else
+				component = std::string(name);
+		}
+
+		object_path.resize(depth);
+
+		if (text.substr(0, 4) != " -> ")
+			throw std::runtime_error("expected ' -> ' after the path");
+
+		text.remove_prefix(4);
+
+		if (text.empty())
+			throw std::runtime_error("missing value");
+
+		switch (text[0])
+		{
+		 case '"':
+			read_quoted(text, token);
+
+			if ( ! text.empty())
+				throw std::runtime_error("text after the string");
+
+			data.add_datum(object_path, std::string(token));
+			return;
+		 case '[':
+			if (text != "[ ]" && text != "[]")
+				throw std::runtime_error("only empty arrays can be values");
+
+			data.add_datum(object_path, empty_array{});
+			return;
+		 case '{':
+			if (text != "{ }" && text != "{}")
+				throw std::runtime_error("only empty objects can be values");
+
+			data.add_datum(object_path, empty_object{});
+			return;
+		}
+
+		if (text == "null")
+		{
+			data.add_datum(object_path, nullptr);
+			return;
+		} else if (text == "true" || text == "false")
+		{
+			data.add_datum(object_path, text[0] == 't');
+			return;
+		}
+
+		// Numbers, typed as the JSON parser would type them.  Those that
+		// don't fit are passed on as written.
+		std::string_view digits = text.substr(text[0] == '-');
+
+		if (digits.empty() || digits[0] < '0' || digits[0] > '9')
+			throw std::runtime_error("bad value '" + std::string(text) + "'");
+
+		if (text.find_first_of(".eE") != std::string_view::npos)
+		{
+			double d;
+
+			if (read_number(text, d))
+			{
+				data.add_datum(object_path, d);
+				return;
+			}
+		} else if (text[0] == '-')
+		{
+			int64_t n;
+
+			if (read_number(text, n))
+			{
+				data.add_datum(object_path, n);
+				return;
+			}
+		} else
+		{
+			uint64_t n;
+
+			if (read_number(text, n))
+			{
+				data.add_datum(object_path, n);
+				return;
+			}
+		}
+
+		data.add_datum(object_path, big_number{std::string(text)});
+	} catch (const std::runtime_error & e)
+	{
+		throw std::runtime_error("unflatten: line " + std::to_string(line_number)
+		                         + ": " + e.what());
+	}
+}
+
+} // namespace serial
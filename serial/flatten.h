@@ -0,0 +1,134 @@
+#ifndef SERIAL_FLATTEN_H
+#define SERIAL_FLATTEN_H 1
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "data_visitor.h"
+
+namespace serial {
+
+// The flattened form is one line per leaf, "<path> -> <value>", as
+// printing_visitor writes it, but exact enough to be read back:
+//
+//   .servers.0.name -> "alpha"
+//   .servers.0.port -> 8080
+//   .servers.1 -> { }
+//   ."a.b"."0" -> null
+//
+// Values are JSON: strings quoted, doubles in shortest round-trip form
+// (whole ones with ".0", so they read back as doubles), empty containers
+// as "[ ]" and "{ }".  Array indices are bare numbers; object keys that
+// are empty, all digits, or contain '.', '"', '\', spaces or control
+// characters are written as JSON strings.
+
+struct flatten_options
+{
+	// Only leaves whose path text matches one of these fnmatch(3)
+	// patterns are written, e.g. ".servers.*.name" or "*.id".  '*' also
+	// matches '.'.  Empty writes everything.
+	std::vector<std::string> filters;
+
+	// Lines are handed to the output in batches of about this size
+	size_t buffer_size = 1024 * 1024;
+};
+
+// Formats leaves into a buffer and hands whole lines to an output
+// function in large batches, instead of a stream call per token.  The
+// path text is kept between calls and only the components that changed
+// since the previous leaf are re-formatted.
+class flattening_visitor final : public data_visitor
+{
+ public:
+	using output = std::function<void(std::string_view lines)>;
+
+	flattening_visitor(const output & out,
+	                   const flatten_options & options = flatten_options());
+
+	// Flushes what is buffered
+	~flattening_visitor();
+
+	using data_visitor::add_datum;
+
+	void add_datum(const path & p, const empty_array &) override;
+
+	void add_datum(const path & p, const empty_object &) override;
+
+	void add_datum(const path & p, std::nullptr_t) override;
+
+	void add_datum(const path & p, bool datum) override;
+
+	void add_datum(const path & p, int64_t datum) override;
+
+	void add_datum(const path & p, uint64_t datum) override;
+
+	void add_datum(const path & p, double datum) override;
+
+	void add_datum(const path & p, std::string && datum) override;
+
+	void add_datum(const path & p, big_number && datum) override;
+
+	// Text written at the start of every following line, such as
+	// "file.json:" when flattening several files.
+	void set_prefix(std::string_view prefix);
+
+	void flush();
+
+ private:
+	// Brings path_text up to date with p and, if p passes the filters,
+	// starts a line with it.
+	bool begin_line(const path & p);
+
+	void end_line()
+	{
+		buffer.push_back('\n');
+
+		if (buffer.size() >= options.buffer_size)
+			flush();
+	}
+
+	output out;
+	flatten_options options;
+	std::string buffer;
+	std::string line_prefix;
+	// The text of last_path, and where each component's text ends in it
+	std::string path_text;
+	std::vector<size_t> component_ends;
+	path last_path;
+};
+
+// Appends one path component as the flattened form writes it.
+void append_path_component(std::string & out,
+                           const std::variant<std::string, uint64_t> & c);
+
+// Reads the flattened form back and hands each leaf to a visitor, e.g.
+// a writer_visitor to get JSON again or a value_store to get a tree.
+// Lines must be in the order flattening produced them.  Malformed lines
+// throw std::runtime_error naming the line number.
+class unflattener
+{
+ public:
+	unflattener(data_visitor & data);
+
+	// Any amount of text; a line cut off at the end is kept until the
+	// rest arrives.
+	void add(std::string_view text);
+
+	// Handles a last line without a newline.
+	void finish();
+
+ private:
+	void line(std::string_view text);
+
+	data_visitor & data;
+	path object_path;
+	std::string partial;
+	std::string token;
+	uint64_t line_number;
+};
+
+} // namespace serial
+
+#endif // SERIAL_FLATTEN_H
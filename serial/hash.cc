@@ -0,0 +1,223 @@
+#include "hash.h"
+
+#include <cstring>
+
+namespace serial {
+
+namespace {
+
+enum tag : uint64_t
+{
+	null_tag = 1,
+	false_tag,
+	true_tag,
+	unsigned_tag,
+	negative_tag,
+	double_tag,
+	string_tag,
+	array_tag,
+	object_tag,
+	big_number_tag,
+};
+
+constexpr uint64_t k0 = 0xa0761d6478bd642full;
+constexpr uint64_t k1 = 0xe7037ed1a0b428dbull;
+constexpr uint64_t k2 = 0x8ebc6af09c88c6e3ull;
+constexpr uint64_t k3 = 0x589965cc75374cc3ull;
+
+// Multiply and fold, as in wyhash
+inline uint64_t mum(uint64_t a, uint64_t b)
+{
+	unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+	return uint64_t(r) ^ uint64_t(r >> 64);
+}
+
+inline digest mix(digest h, uint64_t x)
+{
+	return digest{mum(h.low ^ k0, x ^ k1), mum(h.high ^ k2, x ^ k3)};
+}
+
+inline digest mix(digest h, const digest & d)
+{
+	return mix(mix(h, d.low), d.high);
+}
+
+inline digest start(uint64_t t)
+{
+	return mix(digest{k2, k0}, t);
+}
+
+// Scalars, for values and for the elements of packed arrays alike
+inline digest hash_scalar(int64_t x)
+{
+	return x < 0 ? mix(start(negative_tag), uint64_t(x))
+	             : mix(start(unsigned_tag), uint64_t(x));
+}
+
+inline digest hash_scalar(uint64_t x)
+{
+	return mix(start(unsigned_tag), x);
+}
+
+inline digest hash_scalar(double x)
+{
+	// 0.0 == -0.0
+	x += 0.0;
+	uint64_t bits;
+	memcpy(&bits, &x, sizeof bits);
+	return mix(start(double_tag), bits);
+}
+
+inline digest hash_scalar(bool x)
+{
+	return start(x ? true_tag : false_tag);
+}
+
+// child(v) hashes a member or element; it is where the cache comes in.
+template <typename Child>
+digest hash_value(const value & v, Child && child)
+{
+	switch (v.datum.index())
+	{
+	 case 0:
+		return hash_scalar(std::get<int64_t>(v.datum));
+	 case 1:
+		return hash_scalar(std::get<uint64_t>(v.datum));
+	 case 2:
+		return hash_scalar(std::get<double>(v.datum));
+	 case 3:
+		return hash_scalar(std::get<bool>(v.datum));
+	 case 4:
+		return start(null_tag);
+	 case 5:
+		return hash_bytes(std::get<std::string>(v.datum), string_tag);
+	 case 6:
+	 {
+		const auto & a = std::get<value::array_ptr_type>(v.datum);
+		digest h = start(array_tag);
+
+		if (a)
+		{
+			for (const auto & element : *a)
+				h = mix(h, child(element));
+			h = mix(h, uint64_t(a->size()));
+		} else
+		{
+			h = mix(h, uint64_t(0));
+		}
+
+		return h;
+	 }
+	 case 7:
+	 {
+		const auto & o = std::get<value::object_ptr_type>(v.datum);
+		// Members are summed, so their order does not matter
+		digest sum;
+		uint64_t n = 0;
+
+		if (o)
+		{
+			for (const auto & [key, member] : *o)
+			{
+				digest m = mix(hash_bytes(key, object_tag), child(member));
+				sum.low += m.low;
+				sum.high += m.high;
+			}
+			n = o->size();
+		}
+
+		return mix(mix(start(object_tag), n), sum);
+	 }
+	 case 8:
+		return hash_bytes(std::get<big_number>(v.datum).text, big_number_tag);
+	 case 9:
+	 {
+		// As the same elements in a generic array
+		const auto & a = std::get<value::packed_array_ptr_type>(v.datum);
+		digest h = start(array_tag);
+
+		a->for_each([&](auto x) {
+			if constexpr (std::is_same_v<decltype(x), value>)
+				h = mix(h, child(x));
+			else
+				h = mix(h, hash_scalar(x));
+		});
+
+		return mix(h, uint64_t(a->size()));
+	 }
+	}
+
+	return digest();
+}
+
+} // namespace
+
+digest hash_bytes(std::string_view bytes, uint64_t seed)
+{
+	digest h = mix(start(seed), uint64_t(bytes.size()));
+	const char * p = bytes.data();
+	size_t n = bytes.size();
+
+	for (; n >= 8; p += 8, n -= 8)
+	{
+		uint64_t chunk;
+		memcpy(&chunk, p, 8);
+		h = mix(h, chunk);
+	}
+
+	if (n)
+	{
+		uint64_t chunk = 0;
+		memcpy(&chunk, p, n);
+		h = mix(h, chunk);
+	}
+
+	return h;
+}
+
+digest content_hash(const value & v)
+{
+	return hash_value(v, [](const value & child) { return content_hash(child); });
+}
+
+//////////////////////////////////////////////////////////////////////
+hash_cache::hash_cache()
+  : containers()
+	{ }
+
+digest hash_cache::operator () (const value & v)
+{
+	std::shared_ptr<const void> owner;
+
+	if (std::holds_alternative<value::array_ptr_type>(v.datum))
+		owner = std::get<value::array_ptr_type>(v.datum);
+	else if (std::holds_alternative<value::object_ptr_type>(v.datum))
+		owner = std::get<value::object_ptr_type>(v.datum);
+	else if (std::holds_alternative<value::packed_array_ptr_type>(v.datum))
+		owner = std::get<value::packed_array_ptr_type>(v.datum);
+
+	if ( ! owner)
+		return hash_value(v, *this);
+
+	auto found = containers.find(owner.get());
+
+	if (found != containers.end())
+		return found->second.hash;
+
+	digest h = hash_value(v, *this);
+	containers.emplace(owner.get(), entry{std::move(owner), h});
+
+	return h;
+}
+
+void hash_cache::forget(const value & v)
+{
+	if (std::holds_alternative<value::array_ptr_type>(v.datum))
+		containers.erase(std::get<value::array_ptr_type>(v.datum).get());
+	else if (std::holds_alternative<value::object_ptr_type>(v.datum))
+		containers.erase(std::get<value::object_ptr_type>(v.datum).get());
+	else if (std::holds_alternative<value::packed_array_ptr_type>(v.datum))
+		containers.erase(std::get<value::packed_array_ptr_type>(v.datum).get());
+}
+
+} // namespace serial
@@ -0,0 +1,75 @@
+#ifndef SERIAL_HASH_H
+#define SERIAL_HASH_H 1
+
+#include <cstdint>
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "data_visitor.h"
+
+namespace serial {
+
+// 128-bit content hash of a subtree.  Values that equal() considers the
+// same hash the same: objects regardless of member order, and int64 and
+// uint64 by numeric value.
+struct digest
+{
+	uint64_t low = 0;
+	uint64_t high = 0;
+
+	bool operator == (const digest & other) const
+		{ return low == other.low && high == other.high; }
+
+	bool operator != (const digest & other) const
+		{ return ! (*this == other); }
+};
+
+digest hash_bytes(std::string_view bytes, uint64_t seed = 0);
+
+// Hashes the whole subtree every time.
+digest content_hash(const value & v);
+
+// Computes subtree hashes bottom-up, remembering the hash of every array
+// and object it has seen by the address of the container, so asking again
+// for a subtree, or for a tree sharing subtrees with one already hashed,
+// costs a lookup.  The containers must not change while cached; the cache
+// keeps them alive so that an address is never reused under it.
+class hash_cache
+{
+ public:
+	hash_cache();
+
+	digest operator () (const value & v);
+
+	// Equal hashes are taken to mean equal subtrees.
+	bool same(const value & a, const value & b)
+		{ return (*this)(a) == (*this)(b); }
+
+	size_t size() const { return containers.size(); }
+
+	// Drops the cached hash of a container that is being thrown away.
+	void forget(const value & v);
+
+	void clear() { containers.clear(); }
+
+ private:
+	struct entry
+	{
+		std::shared_ptr<const void> owner;
+		digest hash;
+	};
+
+	std::unordered_map<const void *, entry> containers;
+};
+
+} // namespace serial
+
+template <>
+struct std::hash<serial::digest>
+{
+	size_t operator () (const serial::digest & d) const { return d.low; }
+};
+
+#endif // SERIAL_HASH_H
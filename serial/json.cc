@@ -0,0 +1,9 @@
+#include "json.h"
+
+namespace serial::json {
+
+template class basic_parser<data_visitor>;
+
+template class basic_parser_pool<data_visitor>;
+
+} // namespace serial::json
@@ -8,22 +8,102 @@
 #include <unordered_map>
 #include <variant>
 #include <charconv>
+#include <string>
+#include <string_view>
 
 #include "data_visitor.h"
+#include "file_reader.h"
+#include "limits.h"
 
 namespace serial::json {
 
 namespace stdfs = std::filesystem;
 
-class parser
+enum class string_encoding
+{
+	utf8,
+	utf32,
+};
+
+struct parse_options
+{
+	// Encoding of string values handed to the data visitor.  With utf32,
+	// strings are decoded to code points by the state machine itself and
+	// delivered as std::u32string; object keys in the path stay UTF-8.
+	string_encoding strings = string_encoding::utf8;
+
+	// Integers outside the int64/uint64 ranges, and decimals with more
+	// significant digits or a larger exponent than a double keeps exactly,
+	// are handed over as big_number with their original text.  Otherwise
+	// they become the nearest double.
+	bool exact_numbers = false;
+
+	// How read_file() gets the file into memory.
+	read_options input;
+
+	// Exceeding one throws limit_exceeded; see parse_limits::untrusted()
+	parse_limits limits;
+};
+
+// The parser hands every value to Visitor::add_datum() with one of the
+// overloads of data_visitor.  basic_parser<data_visitor> (aka parser) is
+// compiled into the library and dispatches through the vtable; a parser
+// over a concrete visitor type lets the compiler inline the callbacks
+// into the state machine.  Such a visitor need not derive from
+// data_visitor, and if it does, it should be final.
+template <typename Visitor>
+class basic_parser
 {
  public:
-	parser();
+	using visitor_type = Visitor;
+
+	basic_parser(const parse_options & options = parse_options());
+
+	// Reads and parses a file, or standard input for "-".  Files and
+	// streams starting with a gzip or zstd header are decompressed on a
+	// separate thread and parsed chunk by chunk as they are produced.
+	// Input that ends before the document does throws std::runtime_error.
+	void read_file(const stdfs::path & filename, Visitor & data);
+
+	// Parses a whole document held in memory.  Input that ends before the
+	// document does throws std::runtime_error.
+	void parse(std::string_view document, Visitor & data);
+
+	// Puts the parser back in its initial state, so it can take another
+	// document.  Buffers keep their capacity.  read_file() and parse() do
+	// this themselves.
+	void reset();
 
-	void read_file(const stdfs::path & filename, data_visitor & data);
+	// ... and switches to different options.
+	void reset(const parse_options & options);
+
+	// How the last read_file() call loaded its input.
+	const read_stats & last_read_stats() const { return last_read; }
 
  private:
-	void parse_data(const char * buffer, size_t n, data_visitor & data);
+	friend class batch_reader;
+	template <typename> friend class basic_parser_pool;
+
+	// A whole document in memory, possibly compressed.
+	void parse_buffer(const char * buffer, size_t n, Visitor & data);
+
+	// whole says the buffer is the entire input, so it is still there to
+	// count lines in if an error turns up; chunks are counted as they go.
+	void parse_data(const char * buffer, size_t n, Visitor & data,
+	                bool whole = false);
+
+	// Completes a number at the end of the input, and throws if the
+	// input ended before the document did.
+	void finish(Visitor & data);
+
+	void append_codepoint(char32_t c);
+
+	void publish_big_number(const char * p, Visitor & data);
+
+	// Counts input against max_bytes before it is parsed
+	void count_input(size_t n);
+
+	void check_string_size(size_t n);
 
 	unsigned cs;
 	unsigned top;
@@ -31,15 +111,106 @@ class parser
 	char * eof;
 	signed exponent;
 	signed fraction_shift;
-	unsigned object_member_count;
 	unsigned line_number;
+	char32_t codepoint;
+	read_options input;
+	read_stats last_read;
+	parse_limits limits;
+	// Values and bytes of input seen so far in this document
+	uint64_t node_count;
+	uint64_t byte_count;
 	std::string token_buffer;
+	std::u32string wide_token_buffer;
 	std::vector<unsigned> stack;
 	std::vector<std::variant<std::string, uint64_t>> object_path;
+	// Where the digits of the current number start in this chunk
+	const char * number_start;
 	bool negative_exponent;
 	bool negative;
+	bool number_overflow;
+	// token_buffer holds the start of a number cut off by a chunk boundary
+	bool number_split;
+	bool utf32_strings;
+	bool exact_numbers;
 };
 
+using parser = basic_parser<data_visitor>;
+
+// Parsers kept for reuse by each thread, for servers parsing many small
+// documents: constructing a parser and growing its buffers again for
+// every request costs more than parsing a short body.
+template <typename Visitor>
+class basic_parser_pool
+{
+ public:
+	// A parser on loan from the calling thread's pool, reset and set up
+	// with the options asked for.  It goes back to the pool when the lease
+	// is destroyed, so a visitor may parse nested documents with leases of
+	// its own.
+	class lease
+	{
+	 public:
+		lease(lease && other) = default;
+
+		// The parser held until now goes back to the pool
+		lease & operator = (lease && other)
+		{
+			if (this != &other)
+			{
+				if (p)
+					basic_parser_pool::release(std::move(p));
+
+				p = std::move(other.p);
+			}
+
+			return *this;
+		}
+
+		~lease() { if (p) basic_parser_pool::release(std::move(p)); }
+
+		basic_parser<Visitor> & operator * () const { return *p; }
+
+		basic_parser<Visitor> * operator -> () const { return p.get(); }
+
+	 private:
+		friend class basic_parser_pool;
+
+		lease(std::unique_ptr<basic_parser<Visitor>> && parser)
+		  : p(std::move(parser))
+			{ }
+
+		std::unique_ptr<basic_parser<Visitor>> p;
+	};
+
+	static lease acquire(const parse_options & options = parse_options());
+
+	// Parses a document with a pooled parser.
+	static void parse(std::string_view document, Visitor & data,
+	                  const parse_options & options = parse_options());
+
+	// Parsers idle per thread, and the largest buffer an idle parser keeps
+	static constexpr size_t max_idle = 4;
+	static constexpr size_t max_kept_buffer = 64 * 1024;
+
+ private:
+	static std::vector<std::unique_ptr<basic_parser<Visitor>>> & idle();
+
+	static void release(std::unique_ptr<basic_parser<Visitor>> && parser);
+};
+
+using parser_pool = basic_parser_pool<data_visitor>;
+
+} // namespace serial::json
+
+// Generated from json.rl
+#include "json_impl.h"
+
+namespace serial::json {
+
+extern template class basic_parser<data_visitor>;
+
+extern template class basic_parser_pool<data_visitor>;
+
 } // namespace serial::json
 
 #endif // JSON_H
@@ -1,16 +1,19 @@
-#include "json.h"
+// Template implementation of serial::json::basic_parser.  This file is
+// run through ragel to produce json_impl.h, which is included at the end of
+// json.h; don't include it directly.
+
+#ifndef SERIAL_JSON_IMPL_H
+#define SERIAL_JSON_IMPL_H 1
 
-#include <sys/stat.h>
-#include <sys/mman.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include "json.h"
 
+#include <algorithm>
 #include <cmath>
-#include <functional>
 #include <iostream>
+#include <type_traits>
 
-#include "util/error_handling.h"
-#include "util/file_descriptor.h"
+#include "util/scan.h"
+#include "util/utf8.h"
 
 namespace serial::json {
 
@@ -28,31 +31,71 @@ inline uint8_t from_hexchar(char c)
 	return rc;
 }
 
-inline void to_utf8(char32_t codoepoint, std::string & destination)
+// integer = integer * 10 + digit, unless that overflows
+inline bool accumulate_digit(uint64_t & integer, char digit)
 {
-	if (codoepoint < 0x80)
-	{
-		destination.push_back(codoepoint);
-	} else if (codoepoint < 0x800)
-	{
-		destination.reserve(2);
-		destination.push_back( 0xc0 | ( (codoepoint >>  6) & 0x1f ) );
-		destination.push_back( 0x80 | ( (codoepoint >>  0) & 0x3f ) );
-	} else if (codoepoint < 0x10000)
-	{
-		destination.reserve(3);
-		destination.push_back( 0xe0 | ( (codoepoint >> 12) & 0x0f ) );
-		destination.push_back( 0x80 | ( (codoepoint >>  6) & 0x3f ) );
-		destination.push_back( 0x80 | ( (codoepoint >>  0) & 0x3f ) );
-	} else if (codoepoint < 0x110000)
+	uint64_t next;
+
+	if (__builtin_mul_overflow(integer, 10, &next)
+	    || __builtin_add_overflow(next, uint64_t(digit - '0'), &next))
+		return false;
+
+	integer = next;
+	return true;
+}
+
+// integer = integer * 10^8n + the runs of eight digits at p, for as many
+// runs as there are and fit in 64 bits; returns the number of digits taken.
+inline size_t accumulate_digit_runs(uint64_t & integer, const char * p,
+                                    const char * pe)
+{
+	const char * start = p;
+
+	while (pe - p >= 8 && util::is_eight_digits(p))
 	{
-		destination.reserve(4);
-		destination.push_back( 0xf0 | ( (codoepoint >> 18) & 0x07 ) );
-		destination.push_back( 0x80 | ( (codoepoint >> 12) & 0x3f ) );
-		destination.push_back( 0x80 | ( (codoepoint >>  6) & 0x3f ) );
-		destination.push_back( 0x80 | ( (codoepoint >>  0) & 0x3f ) );
-	} else
-		throw std::runtime_error("unicode code point is too large");
+		uint64_t next;
+
+		if (__builtin_mul_overflow(integer, 100000000, &next)
+		    || __builtin_add_overflow(next, util::parse_eight_digits(p), &next))
+			break;
+
+		integer = next;
+		p += 8;
+	}
+
+	return p - start;
+}
+
+// Decimals with fewer significant digits than this survive the round trip
+// through a double.
+static constexpr uint64_t exact_double_limit = 1000000000000000;
+
+template <typename Visitor>
+inline void basic_parser<Visitor>::append_codepoint(char32_t c)
+{
+	if (utf32_strings)
+		wide_token_buffer.push_back(c);
+	else
+		util::to_utf8(c, token_buffer);
+
+	check_string_size(utf32_strings ? wide_token_buffer.size() * sizeof(char32_t)
+	                                : token_buffer.size());
+}
+
+template <typename Visitor>
+inline void basic_parser<Visitor>::check_string_size(size_t n)
+{
+	if (n > limits.max_string_bytes) [[unlikely]]
+		throw limit_exceeded(limit::string_bytes, limits.max_string_bytes);
+}
+
+template <typename Visitor>
+inline void basic_parser<Visitor>::count_input(size_t n)
+{
+	byte_count += n;
+
+	if (byte_count > limits.max_bytes) [[unlikely]]
+		throw limit_exceeded(limit::bytes, limits.max_bytes);
 }
 
 %%{
@@ -64,6 +107,14 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 
 	prepush {
 //		printf("PUSH\n");
+		// Every value inside an array or object comes through here, so
+		// one place bounds both the nesting and the number of values
+		if (stack.size() >= limits.max_depth) [[unlikely]]
+			throw limit_exceeded(limit::depth, limits.max_depth);
+
+		if (++node_count > limits.max_nodes) [[unlikely]]
+			throw limit_exceeded(limit::nodes, limits.max_nodes);
+
 		stack.push_back(0);
 	}
 
@@ -76,20 +127,50 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 
 	action string_start {
 		token_buffer.clear();
+		wide_token_buffer.clear();
 	}
 	action string_append {
-		token_buffer.push_back(*p);
+		if ( ! utf32_strings )
+		{
+			token_buffer.push_back(*p);
+
+			// An ASCII character completes a string_character, so the
+			// plain run after it can be taken as a whole
+			if (static_cast<unsigned char>(*p) < 0x80)
+			{
+				const char * end = util::skip_plain_string(p + 1, pe);
+				token_buffer.append(p + 1, end);
+				fexec end;
+			}
+
+			check_string_size(token_buffer.size());
+		}
+	}
+	action string_append_codepoint {
+		if (utf32_strings)
+		{
+			wide_token_buffer.push_back(codepoint);
+			check_string_size(wide_token_buffer.size() * sizeof(char32_t));
+		}
+	}
+	action utf8_lead1 { codepoint = *p; }
+	action utf8_lead2 { codepoint = *p & 0x1f; }
+	action utf8_lead3 { codepoint = *p & 0x0f; }
+	action utf8_lead4 { codepoint = *p & 0x07; }
+	action utf8_continuation {
+		codepoint = (codepoint << 6) | (*p & 0x3f);
 	}
 	action string_append_escape {
 		switch (*p)
 		{
-		 case '"': token_buffer.push_back('"'); break;
-		 case '\\': token_buffer.push_back('\\'); break;
-		 case 'b': token_buffer.push_back('\b'); break;
-		 case 'f': token_buffer.push_back('\f'); break;
-		 case 'n': token_buffer.push_back('\n'); break;
-		 case 'r': token_buffer.push_back('\r'); break;
-		 case 't': token_buffer.push_back('\t'); break;
+		 case '"': append_codepoint('"'); break;
+		 case '\\': append_codepoint('\\'); break;
+		 case '/': append_codepoint('/'); break;
+		 case 'b': append_codepoint('\b'); break;
+		 case 'f': append_codepoint('\f'); break;
+		 case 'n': append_codepoint('\n'); break;
+		 case 'r': append_codepoint('\r'); break;
+		 case 't': append_codepoint('\t'); break;
 		 default:
 			throw std::runtime_error("bad escape");
 			break;
@@ -107,9 +188,13 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 		exponent = 0;
 		negative_exponent = false;
 		fraction_shift = 0;
+		number_overflow = false;
+	}
+	action mark_number_start {
+		number_start = p;
 	}
 	action save_unicode {
-		to_utf8(integer_buffer, token_buffer);
+		append_codepoint(integer_buffer);
 	}
 	action state_return {
 //		printf("returning (%zu)\n", stack.size());
@@ -124,20 +209,17 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 		fcall json_value;
 	}
 	action push_index {
-		object_path.push_back(0);
+		object_path.emplace_back(std::in_place_type<uint64_t>, 0);
 	}
 	action push_key {
-		object_member_count = 0;
 		token_buffer.clear();
-		object_path.push_back(token_buffer);
+		object_path.emplace_back(std::in_place_type<std::string>);
 	}
 	action pop_index {
 		object_path.pop_back();
 	}
 	action pop_key {
 		object_path.pop_back();
-		if (object_member_count == 0)
-			data.add_datum(object_path, empty_object{});
 	}
 	action increment_path_index {
 		++std::get<uint64_t>(object_path.back());
@@ -146,25 +228,54 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 		std::get<std::string>(object_path.back()) = token_buffer;
 	}
 	action process_value {
-		data.add_datum(object_path, std::move(token_buffer));
+		// Copies, no larger than the string, so that the buffers keep
+		// their capacity for the next one
+		if (utf32_strings)
+			data.add_datum(object_path, std::u32string(wide_token_buffer));
+		else
+			data.add_datum(object_path, std::string(token_buffer));
 	}
 	action hold_char { fhold; }
 
 	action accumulate_fraction {
-		integer_buffer *= 10;
-		integer_buffer += *p - '0';
-		--fraction_shift;
+		// Digits beyond 64 bits are dropped
+		if ( ! number_overflow && accumulate_digit(integer_buffer, *p))
+		{
+			--fraction_shift;
+
+			if (size_t n = accumulate_digit_runs(integer_buffer, p + 1, pe))
+			{
+				fraction_shift -= n;
+				fexec p + 1 + n;
+			}
+		} else
+		{
+			number_overflow = true;
+		}
 	}
 	action clear_sign { negative = false; }
 	action negate_value { negative = true; }
 	action accumulate_int {
-		integer_buffer *= 10;
-		integer_buffer += *p - '0';
+		// ... and count as a power of ten
+		if (number_overflow || ! accumulate_digit(integer_buffer, *p))
+		{
+			number_overflow = true;
+			++fraction_shift;
+		} else if (integer_buffer != 0)
+		{
+			// The rest of a long integer eight digits at a time.  Not
+			// after a leading zero, which has to end the integer.
+			if (size_t n = accumulate_digit_runs(integer_buffer, p + 1, pe))
+				fexec p + 1 + n;
+		}
 	}
 
 	action accumulate_exponent {
-		exponent *= 10;
-		exponent += *p - '0';
+		if (exponent < 100000)
+		{
+			exponent *= 10;
+			exponent += *p - '0';
+		}
 	}
 
 	action negate_exponent {
@@ -175,7 +286,10 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 		if (negative_exponent)
 			exponent = -exponent;
 
-		if ((exponent + fraction_shift) == 0)
+		exponent += fraction_shift;
+
+		if (exponent == 0 && ! number_overflow
+		    && ( ! negative || integer_buffer <= uint64_t(1) << 63))
 		{
 			if (negative)
 			{
@@ -185,10 +299,14 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 			{
 				data.add_datum(object_path, integer_buffer);
 			}
+		} else if (exact_numbers
+		           && (number_overflow || exponent == 0
+		               || integer_buffer >= exact_double_limit
+		               || exponent > 290 || exponent < -290))
+		{
+			publish_big_number(p, data);
 		} else
 		{
-			exponent += fraction_shift;
-
 			double value = integer_buffer;
 			value *= std::pow<double>(10, exponent);
 
@@ -197,6 +315,9 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 
 			data.add_datum(object_path, value);
 		}
+
+		number_start = nullptr;
+		number_split = false;
 	}
 	action publish_true {
 		data.add_datum(object_path, true);
@@ -208,46 +329,60 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 		data.add_datum(object_path, nullptr);
 	}
 
-	ws = (0x20 | 0x0a @ { ++line_number; } | 0x0d | 0x09);
+	action skip_whitespace {
+		// The rest of the run in one go; only ever attached where the
+		// machine loops on whitespace
+		fexec util::skip_whitespace(p + 1, pe);
+	}
+
+	ws = (0x20 | 0x0a | 0x0d | 0x09);
+
+	ws_run = (ws @ skip_whitespace)*;
 
 	unicode_hexdigit = [0-9a-fA-F] @ unicode_escape_char;
 
-	escaped_character = '\\' ["\/bfnrt] $ string_append_escape;
+	escaped_character = '\\' ["\\/bfnrt] $ string_append_escape;
 
 	action save_be_surrogate {
 		uint32_t tmp = (integer_buffer >> 6) & 0x000ffc00;
 		tmp |= (integer_buffer & 0x0000003ff);
 		tmp += 0x10000;
-		to_utf8(tmp, token_buffer);
+		append_codepoint(tmp);
 	}
 	action save_le_surrogate {
 		uint32_t tmp = (integer_buffer >> 16) & 0x000003ff;
 		tmp |= ((integer_buffer << 10) & 0x0000ffc00);
 		tmp += 0x10000;
-		to_utf8(tmp, token_buffer);
+		append_codepoint(tmp);
 	}
 
 	unicode_escape =
 		'\\' 'u' > reset_integer_buffer
-		( ( ( ( [0-9a-cefA-CEF][0-9a-fA-F]{3} )
-		    | ( [dD][0-7][0-9a-fA-F]{2} ) ) )
-		  $ unicode_escape_char
+		# Alternatives starting with the same digit share it, so that
+		# unicode_escape_char runs on it once rather than once for each
+		( ( [0-9a-cefA-CEF][0-9a-fA-F]{3} ) $ unicode_escape_char
 		  % save_unicode
-		| ( ( [dD][89aAbB][0-9a-fA-F]{2} ) $ unicode_escape_char
-		    '\\' 'u' ( [dD][c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char )
-		  % save_be_surrogate
-		| ( ( [dD][c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char
-		    '\\' 'u' ( [dD][89aAbB][0-9a-fA-F]{2} ) $unicode_escape_char )
-		  % save_le_surrogate
+		| [dD] @ unicode_escape_char
+		  ( ( [0-7][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    % save_unicode
+		  | ( [89aAbB][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    '\\' 'u' ( [dD][c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    % save_be_surrogate
+		  | ( [c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    '\\' 'u' ( [dD][89aAbB][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    % save_le_surrogate
+		  )
 		)
 		;
 
+	continuation_byte = (0x80 .. 0xbf) @ utf8_continuation;
+
 	string_character =
-		( ( (0x00 .. 0x7f) - ( '\\' | '"' ) )
-		| ( (0xc0 .. 0xdf) (0x80 .. 0xbf) )
-		| ( (0xe0 .. 0xef) (0x80 .. 0xbf){2} )
-		| ( (0xf0 .. 0xf7) (0x80 .. 0xbf){3} )
-		) $ string_append;
+		( ( ( (0x00 .. 0x7f) - ( '\\' | '"' ) ) @ utf8_lead1 )
+		| ( (0xc0 .. 0xdf) @ utf8_lead2 continuation_byte )
+		| ( (0xe0 .. 0xef) @ utf8_lead3 continuation_byte{2} )
+		| ( (0xf0 .. 0xf7) @ utf8_lead4 continuation_byte{3} )
+		) $ string_append @ string_append_codepoint;
 
 	string_characters =
 		( string_character
@@ -258,17 +393,20 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 
 	action label_start {
 		std::get<std::string>(object_path.back()).clear();
-		++object_member_count;
 	}
 	action label_append {
-		std::get<std::string>(object_path.back()).push_back(*p);
+		std::string & s = std::get<std::string>(object_path.back());
+		s.push_back(*p);
+		check_string_size(s.size());
 	}
 	action label_append_escape {
 		std::string & s = std::get<std::string>(object_path.back());
+		check_string_size(s.size() + 1);
 		switch (*p)
 		{
 		 case '"': s.push_back('"'); break;
 		 case '\\': s.push_back('\\'); break;
+		 case '/': s.push_back('/'); break;
 		 case 'b': s.push_back('\b'); break;
 		 case 'f': s.push_back('\f'); break;
 		 case 'n': s.push_back('\n'); break;
@@ -280,40 +418,46 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 		}
 	}
 	action label_save_unicode {
-		to_utf8(integer_buffer, std::get<std::string>(object_path.back()));
+		std::string & s = std::get<std::string>(object_path.back());
+		util::to_utf8(integer_buffer, s);
+		check_string_size(s.size());
 	}
 
 	action label_save_be_surrogate {
 		uint32_t tmp = (integer_buffer >> 6) & 0x000ffc00;
 		tmp |= (integer_buffer & 0x0000003ff);
 		tmp += 0x10000;
-		to_utf8(tmp, std::get<std::string>(object_path.back()));
+		std::string & s = std::get<std::string>(object_path.back());
+		util::to_utf8(tmp, s);
+		check_string_size(s.size());
 	}
 	action label_save_le_surrogate {
 		uint32_t tmp = (integer_buffer >> 16) & 0x000003ff;
 		tmp |= ((integer_buffer << 10) & 0x0000ffc00);
 		tmp += 0x10000;
-		to_utf8(tmp, std::get<std::string>(object_path.back()));
+		std::string & s = std::get<std::string>(object_path.back());
+		util::to_utf8(tmp, s);
+		check_string_size(s.size());
 	}
 
 	label_unicode_hexdigit = [0-9a-fA-F] @ unicode_escape_char;
 
-	label_escaped_character = '\\' ["\/bfnrt] $ label_append_escape;
+	label_escaped_character = '\\' ["\\/bfnrt] $ label_append_escape;
 
 	label_unicode_escape =
 		'\\' 'u' > reset_integer_buffer
-		( ( ( ( [0-9a-cefA-CEF][0-9a-fA-F]{3} )
-		    | ( [dD][0-7][0-9a-fA-F]{2} ) ) )
-		  $ unicode_escape_char
+		( ( [0-9a-cefA-CEF][0-9a-fA-F]{3} ) $ unicode_escape_char
 		  % label_save_unicode
-		| ( ( [dD][89aAbB][0-9a-fA-F]{2} ) $ unicode_escape_char
-		    '\\' 'u' ( [dD][c-fC-F][0-9a-fA-F]{2} )
-		    $ unicode_escape_char )
-		  % label_save_be_surrogate
-		| ( ( [dD][c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char
-		    '\\' 'u' ( [dD][89aAbB][0-9a-fA-F]{2} )
-		    $ unicode_escape_char )
-		  % label_save_le_surrogate
+		| [dD] @ unicode_escape_char
+		  ( ( [0-7][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    % label_save_unicode
+		  | ( [89aAbB][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    '\\' 'u' ( [dD][c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    % label_save_be_surrogate
+		  | ( [c-fC-F][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    '\\' 'u' ( [dD][89aAbB][0-9a-fA-F]{2} ) $ unicode_escape_char
+		    % label_save_le_surrogate
+		  )
 		)
 		;
 
@@ -345,10 +489,10 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 
 	number =
 		sign? > clear_sign @ negate_value
-		integer > reset_integer_buffer @ accumulate_int
+		integer > reset_integer_buffer > mark_number_start @ accumulate_int
 		( '.' fraction @ accumulate_fraction )?
 		exponent ?
-		(ws | ',' | ']' | '}') @ hold_char;
+		(ws | ',' | ']' | '}');
 
 	value_start_char = [[{\-0-9tfn\"];
 
@@ -360,35 +504,43 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 			data.add_datum(object_path, empty_object{ });
 	}
 
+	# Each element is followed by one ws_run before the ',' or the closing
+	# bracket, so that no input can be taken two ways: actions of
+	# alternatives that overlap would all run.
+	array_elements =
+		value_start_char > push_index @ hold_recurse ws_run
+		( ',' ws_run value_start_char > increment_path_index @ hold_recurse
+		  ws_run )*;
+
 	array =
-		( ( '[' ws* ']' ) @ publish_empty_array
-		| ( '[' ws* value_start_char > push_index  @ hold_recurse
-		( ws* ',' ws* value_start_char > increment_path_index @hold_recurse )*
-		ws* ']' > pop_index ) );
+		'[' ws_run
+		( ']' @ publish_empty_array
+		| array_elements ']' > pop_index );
 
-	object_element =
-		ws* label ws* ':' @recurse;
+	object_members =
+		label ws_run ':' @ recurse ws_run
+		( ',' ws_run label ws_run ':' @ recurse ws_run )*;
 
 	object =
-		'{' @ push_key
-		( ws*
-		| object_element
-		| object_element ( ',' object_element )* )
-		ws* '}' @ pop_key;
+		'{' @ push_key ws_run
+		( '}' @ pop_key @ publish_empty_object
+		| object_members '}' @ pop_key );
 
 	boolean = "true" @ publish_true | "false" @ publish_false;
 
 	null_value = "null" @ publish_null;
 
 	json =
-		ws*
+		ws_run
 		( string @ process_value
-		| number @ publish_number
+		# The character after the number ends it; publish_number takes
+		# the text up to it before it is given back
+		| number @ publish_number @ hold_char
 		| null_value
 		| boolean
 		| array
 		| object
-		) ws*;
+		) ws_run;
 
 	json_value := json @ state_return;
 
@@ -399,68 +551,248 @@ inline void to_utf8(char32_t codoepoint, std::string & destination)
 
 %%write data;
 
-parser::parser()
+template <typename Visitor>
+basic_parser<Visitor>::basic_parser(const parse_options & options)
   : cs(0)
   , top(0)
   , integer_buffer(0)
   , eof(nullptr)
   , exponent(0)
   , fraction_shift(0)
-  , object_member_count(0)
   , line_number(1)
+  , codepoint(0)
+  , input(options.input)
+  , last_read()
+  , limits(options.limits.effective())
+  , node_count(1)
+  , byte_count(0)
   , token_buffer()
+  , wide_token_buffer()
   , stack()
   , object_path()
+  , number_start(nullptr)
   , negative_exponent(false)
   , negative(false)
+  , number_overflow(false)
+  , number_split(false)
+  , utf32_strings(options.strings == string_encoding::utf32)
+  , exact_numbers(options.exact_numbers)
 {
 	%%write init;
 }
 
-void parser::read_file(const stdfs::path & filename, data_visitor & data)
+template <typename Visitor>
+void basic_parser<Visitor>::reset()
 {
-	util::file_descriptor fd = (
-		filename == "-" ? dup(0) : open(filename.c_str(), O_RDONLY) );
+	integer_buffer = 0;
+	exponent = 0;
+	fraction_shift = 0;
+	line_number = 1;
+	codepoint = 0;
+	// The document itself is the first value
+	node_count = 1;
+	byte_count = 0;
+	token_buffer.clear();
+	wide_token_buffer.clear();
+	stack.clear();
+	object_path.clear();
+	number_start = nullptr;
+	negative_exponent = false;
+	negative = false;
+	number_overflow = false;
+	number_split = false;
+
+	%%write init;
+}
 
-	if (fd < 0)
-		util::throw_errno("Could not open file '%s'", filename.c_str());
+template <typename Visitor>
+void basic_parser<Visitor>::reset(const parse_options & options)
+{
+	input = options.input;
+	utf32_strings = (options.strings == string_encoding::utf32);
+	exact_numbers = options.exact_numbers;
+	limits = options.limits.effective();
 
-	struct stat st;
-	fstat(fd, &st);
+	reset();
+}
 
-	std::unique_ptr<void, std::function<void(void*)>> ptr(
-		mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0),
-		[&](void * x) { if (x != MAP_FAILED) munmap(x, st.st_size); });
+template <typename Visitor>
+void basic_parser<Visitor>::read_file(const stdfs::path & filename,
+                                      Visitor & data)
+{
+	reset();
 
-	if (ptr.get() == MAP_FAILED)
-	{
-		static constexpr size_t bufsz = 16384;
-		char buffer[bufsz];
-		ssize_t n = 0;
+	last_read = serial::read_file(filename, input,
+		[&](const char * buffer, size_t n, bool whole) {
+			count_input(n);
+			parse_data(buffer, n, data, whole);
+		});
 
-		while ((n = read(fd, buffer, bufsz)) > 0)
-			parse_data(buffer, n, data);
-	} else
-	{
-		parse_data(static_cast<char *>(ptr.get()), st.st_size, data);
-	}
+	finish(data);
 }
 
-void parser::parse_data(const char * buffer, size_t n, data_visitor & data)
+template <typename Visitor>
+void basic_parser<Visitor>::parse(std::string_view document, Visitor & data)
+{
+	reset();
+	count_input(document.size());
+	parse_data(document.data(), document.size(), data, true);
+	finish(data);
+}
+
+template <typename Visitor>
+void basic_parser<Visitor>::parse_buffer(const char * buffer, size_t n,
+                                         Visitor & data)
+{
+	reset();
+
+	read_buffer(buffer, n,
+		[&](const char * chunk, size_t chunk_n, bool whole) {
+			count_input(chunk_n);
+			parse_data(chunk, chunk_n, data, whole);
+		});
+
+	finish(data);
+}
+
+template <typename Visitor>
+void basic_parser<Visitor>::finish(Visitor & data)
+{
+	// A number at the very end is only complete once something follows it
+	if (cs < json_first_final)
+		parse_data(" ", 1, data);
+
+	if (cs < json_first_final)
+		throw std::runtime_error("Parse failed: unexpected end of input\n");
+}
+
+template <typename Visitor>
+void basic_parser<Visitor>::parse_data(const char * buffer, size_t n,
+                                       Visitor & data, bool whole)
 {
 	const char * p = buffer;
 	const char * pe = p + n;
 
+	if (number_split)
+		number_start = p;
+
 	%%write exec;
 
+	// A number running into the next chunk keeps its text so far
+	if (exact_numbers && number_start)
+	{
+		if (number_split)
+			token_buffer.append(number_start, pe);
+		else
+			token_buffer.assign(number_start, pe);
+
+		check_string_size(token_buffer.size());
+		number_start = nullptr;
+		number_split = true;
+	}
+
+	// Line numbers are not tracked by the state machine.  Chunks are not
+	// kept, so each one's newlines are counted after it has been parsed;
+	// whole input only needs counting on an error, or when finish() has
+	// yet to feed it the end of a trailing number.
 	if (cs <= json_error)
 	{
-		std::cerr << "cs = " << cs << ", pos = '" << p << "'\n";
+		std::cerr << "cs = " << cs << ", line = "
+		          << line_number + util::count_newlines(buffer, p)
+		          << ", pos = '"
+		          << std::string_view(p, std::min<size_t>(pe - p, 40)) << "'\n";
 		throw std::runtime_error("Parse failed\n");
-	} else if ( cs >= json_first_final )
-	{
-		std::cerr << "Parse success, " << (line_number - 1) << " lines read\n";
 	}
+
+	if ( ! whole || cs < json_first_final)
+		line_number += util::count_newlines(buffer, pe);
+}
+
+template <typename Visitor>
+void basic_parser<Visitor>::publish_big_number(const char * p, Visitor & data)
+{
+	if (number_split)
+		token_buffer.append(number_start, p);
+	else
+		token_buffer.assign(number_start, p);
+
+	check_string_size(token_buffer.size());
+	number_split = false;
+
+	big_number n;
+	n.text.reserve(token_buffer.size() + 1);
+
+	if (negative)
+		n.text.push_back('-');
+
+	n.text += token_buffer;
+
+	if constexpr (requires (Visitor & v, path & o, big_number && b)
+	              { v.add_datum(o, std::move(b)); })
+		data.add_datum(object_path, std::move(n));
+	else
+		data.add_datum(object_path, n.to_double());
+}
+
+//////////////////////////////////////////////////////////////////////
+template <typename Visitor>
+std::vector<std::unique_ptr<basic_parser<Visitor>>> &
+basic_parser_pool<Visitor>::idle()
+{
+	thread_local std::vector<std::unique_ptr<basic_parser<Visitor>>> parsers;
+	return parsers;
+}
+
+template <typename Visitor>
+typename basic_parser_pool<Visitor>::lease
+basic_parser_pool<Visitor>::acquire(const parse_options & options)
+{
+	auto & parsers = idle();
+
+	if (parsers.empty())
+		return lease(std::make_unique<basic_parser<Visitor>>(options));
+
+	std::unique_ptr<basic_parser<Visitor>> p = std::move(parsers.back());
+	parsers.pop_back();
+	p->reset(options);
+
+	return lease(std::move(p));
+}
+
+template <typename Visitor>
+void basic_parser_pool<Visitor>::parse(std::string_view document,
+                                       Visitor & data,
+                                       const parse_options & options)
+{
+	acquire(options)->parse(document, data);
+}
+
+template <typename Visitor>
+void basic_parser_pool<Visitor>::release(
+	std::unique_ptr<basic_parser<Visitor>> && p)
+{
+	auto & parsers = idle();
+
+	if (parsers.size() >= max_idle)
+		return;
+
+	// One huge document shouldn't pin its buffers for the thread's lifetime
+	auto trim = [](auto & buffer) {
+		using buffer_type = std::remove_reference_t<decltype(buffer)>;
+
+		if (buffer.capacity() * sizeof(typename buffer_type::value_type)
+		    > max_kept_buffer)
+			buffer_type().swap(buffer);
+	};
+
+	trim(p->token_buffer);
+	trim(p->wide_token_buffer);
+	trim(p->stack);
+	trim(p->object_path);
+
+	parsers.push_back(std::move(p));
 }
 
 } // namespacee serial::json
+
+#endif // SERIAL_JSON_IMPL_H
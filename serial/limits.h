@@ -0,0 +1,86 @@
+#ifndef SERIAL_LIMITS_H
+#define SERIAL_LIMITS_H 1
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace serial {
+
+// Bounds on what a parser accepts from input it doesn't trust.  Zero
+// means no limit.  They are checked as the input is consumed, and the
+// first one exceeded throws limit_exceeded, so the time and memory spent
+// on a hostile document is bounded by the limits rather than its size.
+struct parse_limits
+{
+	// Arrays and objects nested in each other.  An empty one at the
+	// innermost level is not counted.
+	uint64_t max_depth = 0;
+
+	// Bytes of a single string value or object key, after unescaping
+	// (4 per character for UTF-32 strings), or of a number kept as text
+	uint64_t max_string_bytes = 0;
+
+	// Values of every kind, arrays and objects included
+	uint64_t max_nodes = 0;
+
+	// Bytes of input, after decompression
+	uint64_t max_bytes = 0;
+
+	// Suggested settings for request-sized documents from the network
+	static parse_limits untrusted()
+		{ return parse_limits{64, 1024 * 1024, 1024 * 1024, 16 * 1024 * 1024}; }
+
+	// The same with zeros turned into the largest value, so each check is
+	// a single comparison
+	parse_limits effective() const
+	{
+		auto or_max = [](uint64_t n) {
+			return n ? n : std::numeric_limits<uint64_t>::max();
+		};
+
+		return parse_limits{or_max(max_depth), or_max(max_string_bytes),
+		                    or_max(max_nodes), or_max(max_bytes)};
+	}
+};
+
+enum class limit
+{
+	depth,
+	string_bytes,
+	nodes,
+	bytes,
+	// value_store's max_index_gap
+	index_gap,
+};
+
+inline const char * to_string(limit l)
+{
+	switch (l)
+	{
+	 case limit::depth: return "nesting depth";
+	 case limit::string_bytes: return "string size";
+	 case limit::nodes: return "number of values";
+	 case limit::bytes: return "input size";
+	 case limit::index_gap: return "array index gap";
+	}
+
+	return "unknown";
+}
+
+class limit_exceeded : public std::runtime_error
+{
+ public:
+	limit_exceeded(limit l, uint64_t max)
+	  : std::runtime_error(std::string(to_string(l)) + " exceeds the limit of "
+	                       + std::to_string(max))
+	  , which(l)
+		{ }
+
+	limit which;
+};
+
+} // namespace serial
+
+#endif // SERIAL_LIMITS_H
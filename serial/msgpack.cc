@@ -0,0 +1,157 @@
+#include "msgpack.h"
+
+#include <ostream>
+
+namespace serial::msgpack {
+
+template class basic_reader<data_visitor>;
+
+namespace {
+
+template <typename T>
+void tagged(std::string & out, uint8_t type, T n)
+{
+	char bytes[1 + sizeof(T)] = { char(type) };
+	util::store_big_endian(n, bytes + 1);
+	out.append(bytes, sizeof bytes);
+}
+
+void unsigned_integer(std::string & out, uint64_t n)
+{
+	if (n < 0x80)
+		out.push_back(char(n));
+	else if (n <= 0xff)
+		tagged(out, 0xcc, uint8_t(n));
+	else if (n <= 0xffff)
+		tagged(out, 0xcd, uint16_t(n));
+	else if (n <= 0xffffffff)
+		tagged(out, 0xce, uint32_t(n));
+	else
+		tagged(out, 0xcf, n);
+}
+
+void signed_integer(std::string & out, int64_t n)
+{
+	if (n >= 0)
+		unsigned_integer(out, n);
+	else if (n >= -32)
+		out.push_back(char(n));
+	else if (n >= INT8_MIN)
+		tagged(out, 0xd0, uint8_t(n));
+	else if (n >= INT16_MIN)
+		tagged(out, 0xd1, uint16_t(n));
+	else if (n >= INT32_MIN)
+		tagged(out, 0xd2, uint32_t(n));
+	else
+		tagged(out, 0xd3, uint64_t(n));
+}
+
+void float64(std::string & out, double d)
+{
+	uint64_t bits;
+	std::memcpy(&bits, &d, sizeof bits);
+	tagged(out, 0xcb, bits);
+}
+
+// fix, 16-bit or 32-bit header for strings, arrays and maps
+void header(std::string & out, size_t n, uint8_t fix, size_t fix_limit,
+            uint8_t type16, uint8_t type32)
+{
+	if (n < fix_limit)
+		out.push_back(char(fix | n));
+	else if (n <= 0xffff)
+		tagged(out, type16, uint16_t(n));
+	else if (n <= 0xffffffff)
+		tagged(out, type32, uint32_t(n));
+	else
+		throw std::runtime_error("MessagePack: more than 2^32 - 1 elements or bytes");
+}
+
+void string(std::string & out, const std::string & s)
+{
+	if (s.size() >= 32 && s.size() <= 0xff)
+		tagged(out, 0xd9, uint8_t(s.size()));
+	else
+		header(out, s.size(), 0xa0, 32, 0xda, 0xdb);
+
+	out += s;
+}
+
+void encode(std::string & out, const value & v)
+{
+	if (std::holds_alternative<std::string>(v.datum))
+	{
+		string(out, std::get<std::string>(v.datum));
+	} else if (std::holds_alternative<int64_t>(v.datum))
+	{
+		signed_integer(out, std::get<int64_t>(v.datum));
+	} else if (std::holds_alternative<uint64_t>(v.datum))
+	{
+		unsigned_integer(out, std::get<uint64_t>(v.datum));
+	} else if (std::holds_alternative<double>(v.datum))
+	{
+		float64(out, std::get<double>(v.datum));
+	} else if (std::holds_alternative<big_number>(v.datum))
+	{
+		float64(out, std::get<big_number>(v.datum).to_double());
+	} else if (std::holds_alternative<bool>(v.datum))
+	{
+		out.push_back(char(std::get<bool>(v.datum) ? 0xc3 : 0xc2));
+	} else if (std::holds_alternative<std::nullptr_t>(v.datum))
+	{
+		out.push_back(char(0xc0));
+	} else if (std::holds_alternative<value::array_ptr_type>(v.datum))
+	{
+		const auto & a = std::get<value::array_ptr_type>(v.datum);
+		header(out, a ? a->size() : 0, 0x90, 16, 0xdc, 0xdd);
+
+		if (a)
+			for (const auto & element : *a)
+				encode(out, element);
+	} else if (v.is_packed_array())
+	{
+		const auto & a = std::get<value::packed_array_ptr_type>(v.datum);
+		header(out, a->size(), 0x90, 16, 0xdc, 0xdd);
+
+		a->for_each([&](auto x) {
+			if constexpr (std::is_same_v<decltype(x), value>)
+				encode(out, x);
+			else if constexpr (std::is_same_v<decltype(x), bool>)
+				out.push_back(char(x ? 0xc3 : 0xc2));
+			else if constexpr (std::is_same_v<decltype(x), double>)
+				float64(out, x);
+			else if constexpr (std::is_same_v<decltype(x), int64_t>)
+				signed_integer(out, x);
+			else
+				unsigned_integer(out, x);
+		});
+	} else if (std::holds_alternative<value::object_ptr_type>(v.datum))
+	{
+		const auto & o = std::get<value::object_ptr_type>(v.datum);
+		header(out, o ? o->size() : 0, 0x80, 16, 0xde, 0xdf);
+
+		if (o)
+			for (const auto & [key, member] : *o)
+			{
+				string(out, key);
+				encode(out, member);
+			}
+	}
+}
+
+} // namespace
+
+void write(std::ostream & out, const value & v)
+{
+	std::string bytes = encode(v);
+	out.write(bytes.data(), bytes.size());
+}
+
+std::string encode(const value & v)
+{
+	std::string out;
+	encode(out, v);
+	return out;
+}
+
+} // namespace serial::msgpack
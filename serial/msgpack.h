@@ -0,0 +1,394 @@
+#ifndef SERIAL_MSGPACK_H
+#define SERIAL_MSGPACK_H 1
+
+#include <cstdint>
+#include <cstring>
+
+#include <charconv>
+#include <filesystem>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "binary_input.h"
+#include "data_visitor.h"
+#include "util/endian.h"
+
+namespace serial::msgpack {
+
+namespace stdfs = std::filesystem;
+
+using parse_options = binary_options;
+
+// Decodes one MessagePack object and hands its values to
+// Visitor::add_datum() the way the JSON parser would: non-negative
+// integers as uint64_t whatever their encoding, negative ones as int64_t,
+// floats as double, and arrays and maps as paths.  str and bin both
+// become std::string.  Map keys must be strings or integers, which become
+// their decimal text.  Extension types are not supported.  Malformed or
+// truncated input throws std::runtime_error.
+template <typename Visitor>
+class basic_reader
+{
+ public:
+	using visitor_type = Visitor;
+
+	basic_reader(const parse_options & options = parse_options());
+
+	// Reads and decodes a file, or standard input for "-", decompressing
+	// gzip and zstd input.  The file must hold exactly one object.
+	void read_file(const stdfs::path & filename, Visitor & data);
+
+	// Decodes the object at the start of buffer; returns its size.
+	size_t parse(const char * buffer, size_t n, Visitor & data);
+
+	// How the last read_file() call loaded its input.
+	const read_stats & last_read_stats() const { return last_read; }
+
+ private:
+	struct level
+	{
+		// Items, or pairs for a map, still to come
+		uint32_t remaining;
+		uint32_t index;
+		bool map;
+	};
+
+	uint8_t next();
+
+	const uint8_t * take(uint64_t n);
+
+	template <typename T>
+	T load() { return util::load_big_endian<T>(take(sizeof(T))); }
+
+	void item(Visitor & data);
+
+	void open_container(bool map, uint32_t count, Visitor & data);
+
+	template <typename T>
+	void integer(T n, Visitor & data);
+
+	void read_key(std::string & key);
+
+	void check_string_size(uint64_t n);
+
+	const uint8_t * p;
+	const uint8_t * pe;
+	parse_options options;
+	parse_limits limits;
+	uint64_t node_count;
+	read_stats last_read;
+	// The whole input, when read_file() gets it in chunks
+	std::string input;
+	std::vector<level> open;
+	path object_path;
+};
+
+using reader = basic_reader<data_visitor>;
+
+// Encodes a value tree with the shortest integer, string and container
+// formats.  Doubles are always float 64; big_number, which MessagePack
+// cannot represent, becomes the nearest double.
+void write(std::ostream & out, const value & v);
+
+std::string encode(const value & v);
+
+//////////////////////////////////////////////////////////////////////
+template <typename Visitor>
+basic_reader<Visitor>::basic_reader(const parse_options & opts)
+  : p(nullptr)
+  , pe(nullptr)
+  , options(opts)
+  , limits(opts.limits.effective())
+  , node_count(0)
+  , last_read()
+  , input()
+  , open()
+  , object_path()
+	{ }
+
+template <typename Visitor>
+void basic_reader<Visitor>::read_file(const stdfs::path & filename,
+                                      Visitor & data)
+{
+	// Objects can't be decoded piecewise as chunks arrive
+	last_read = read_binary_file(filename, options.input, limits.max_bytes,
+	                             input, [&](const char * buffer, size_t n) {
+		if (parse(buffer, n, data) != n)
+			throw std::runtime_error("MessagePack: data after the first object");
+	});
+}
+
+template <typename Visitor>
+size_t basic_reader<Visitor>::parse(const char * buffer, size_t n,
+                                    Visitor & data)
+{
+	if (n > limits.max_bytes)
+		throw limit_exceeded(limit::bytes, limits.max_bytes);
+
+	p = reinterpret_cast<const uint8_t *>(buffer);
+	pe = p + n;
+	open.clear();
+	object_path.clear();
+	node_count = 1;
+
+	item(data);
+
+	while ( ! open.empty())
+	{
+		level & l = open.back();
+
+		if (l.remaining == 0)
+		{
+			open.pop_back();
+			object_path.pop_back();
+			continue;
+		}
+
+		--l.remaining;
+
+		if (l.map)
+			read_key(std::get<std::string>(object_path.back()));
+		else
+			std::get<uint64_t>(object_path.back()) = l.index++;
+
+		if (++node_count > limits.max_nodes)
+			throw limit_exceeded(limit::nodes, limits.max_nodes);
+
+		item(data);
+	}
+
+	return p - reinterpret_cast<const uint8_t *>(buffer);
+}
+
+template <typename Visitor>
+inline uint8_t basic_reader<Visitor>::next()
+{
+	if (p == pe)
+		throw std::runtime_error("MessagePack: truncated input");
+
+	return *p++;
+}
+
+template <typename Visitor>
+inline const uint8_t * basic_reader<Visitor>::take(uint64_t n)
+{
+	if (uint64_t(pe - p) < n)
+		throw std::runtime_error("MessagePack: truncated input");
+
+	const uint8_t * start = p;
+	p += n;
+
+	return start;
+}
+
+template <typename Visitor>
+template <typename T>
+inline void basic_reader<Visitor>::integer(T n, Visitor & data)
+{
+	// The same types the JSON parser would pick for the number
+	if (n >= 0)
+		data.add_datum(object_path, uint64_t(n));
+	else
+		data.add_datum(object_path, int64_t(n));
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::item(Visitor & data)
+{
+	uint8_t type = next();
+
+	// positive fixint, fixmap, fixarray, fixstr, negative fixint
+	if (type < 0x80)
+	{
+		data.add_datum(object_path, uint64_t(type));
+		return;
+	} else if (type < 0x90)
+	{
+		open_container(true, type & 0x0f, data);
+		return;
+	} else if (type < 0xa0)
+	{
+		open_container(false, type & 0x0f, data);
+		return;
+	} else if (type < 0xc0)
+	{
+		size_t n = type & 0x1f;
+		check_string_size(n);
+		data.add_datum(object_path,
+			std::string(reinterpret_cast<const char *>(take(n)), n));
+		return;
+	} else if (type >= 0xe0)
+	{
+		data.add_datum(object_path, int64_t(int8_t(type)));
+		return;
+	}
+
+	switch (type)
+	{
+	 case 0xc0:
+		data.add_datum(object_path, nullptr);
+		break;
+	 case 0xc2:
+		data.add_datum(object_path, false);
+		break;
+	 case 0xc3:
+		data.add_datum(object_path, true);
+		break;
+	 case 0xca:
+	 {
+		uint32_t bits = load<uint32_t>();
+		float f;
+		std::memcpy(&f, &bits, sizeof f);
+		data.add_datum(object_path, double(f));
+		break;
+	 }
+	 case 0xcb:
+	 {
+		uint64_t bits = load<uint64_t>();
+		double d;
+		std::memcpy(&d, &bits, sizeof d);
+		data.add_datum(object_path, d);
+		break;
+	 }
+	 case 0xcc: data.add_datum(object_path, uint64_t(load<uint8_t>())); break;
+	 case 0xcd: data.add_datum(object_path, uint64_t(load<uint16_t>())); break;
+	 case 0xce: data.add_datum(object_path, uint64_t(load<uint32_t>())); break;
+	 case 0xcf: data.add_datum(object_path, load<uint64_t>()); break;
+	 case 0xd0: integer(int8_t(load<uint8_t>()), data); break;
+	 case 0xd1: integer(int16_t(load<uint16_t>()), data); break;
+	 case 0xd2: integer(int32_t(load<uint32_t>()), data); break;
+	 case 0xd3: integer(int64_t(load<uint64_t>()), data); break;
+	 // bin and str
+	 case 0xc4:
+	 case 0xc5:
+	 case 0xc6:
+	 case 0xd9:
+	 case 0xda:
+	 case 0xdb:
+	 {
+		uint32_t n;
+
+		if (type == 0xc4 || type == 0xd9)
+			n = load<uint8_t>();
+		else if (type == 0xc5 || type == 0xda)
+			n = load<uint16_t>();
+		else
+			n = load<uint32_t>();
+
+		check_string_size(n);
+		data.add_datum(object_path,
+			std::string(reinterpret_cast<const char *>(take(n)), n));
+		break;
+	 }
+	 case 0xdc: open_container(false, load<uint16_t>(), data); break;
+	 case 0xdd: open_container(false, load<uint32_t>(), data); break;
+	 case 0xde: open_container(true, load<uint16_t>(), data); break;
+	 case 0xdf: open_container(true, load<uint32_t>(), data); break;
+	 case 0xc1:
+		throw std::runtime_error("MessagePack: reserved type 0xc1");
+	 default:
+		throw std::runtime_error("MessagePack: extension types are not supported");
+	}
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::open_container(bool map, uint32_t count,
+                                           Visitor & data)
+{
+	if (count == 0)
+	{
+		if (map)
+			data.add_datum(object_path, empty_object{});
+		else
+			data.add_datum(object_path, empty_array{});
+
+		return;
+	}
+
+	if (open.size() >= limits.max_depth)
+		throw limit_exceeded(limit::depth, limits.max_depth);
+
+	open.push_back(level{count, 0, map});
+
+	if (map)
+		object_path.emplace_back(std::string());
+	else
+		object_path.emplace_back(uint64_t(0));
+}
+
+template <typename Visitor>
+void basic_reader<Visitor>::read_key(std::string & key)
+{
+	uint8_t type = next();
+	uint32_t n;
+	char digits[24];
+
+	if (type >= 0xa0 && type < 0xc0)
+	{
+		n = type & 0x1f;
+	} else if (type == 0xd9 || type == 0xc4)
+	{
+		n = load<uint8_t>();
+	} else if (type == 0xda || type == 0xc5)
+	{
+		n = load<uint16_t>();
+	} else if (type == 0xdb || type == 0xc6)
+	{
+		n = load<uint32_t>();
+	} else
+	{
+		int64_t i = 0;
+		uint64_t u = 0;
+		bool is_signed = true;
+
+		if (type < 0x80)
+			i = type;
+		else if (type >= 0xe0)
+			i = int8_t(type);
+		else if (type == 0xcc)
+			i = load<uint8_t>();
+		else if (type == 0xcd)
+			i = load<uint16_t>();
+		else if (type == 0xce)
+			i = load<uint32_t>();
+		else if (type == 0xcf)
+		{
+			u = load<uint64_t>();
+			is_signed = false;
+		} else if (type == 0xd0)
+			i = int8_t(load<uint8_t>());
+		else if (type == 0xd1)
+			i = int16_t(load<uint16_t>());
+		else if (type == 0xd2)
+			i = int32_t(load<uint32_t>());
+		else if (type == 0xd3)
+			i = int64_t(load<uint64_t>());
+		else
+			throw std::runtime_error("MessagePack: map key is not a string or integer");
+
+		char * end = is_signed
+			? std::to_chars(digits, digits + sizeof digits, i).ptr
+			: std::to_chars(digits, digits + sizeof digits, u).ptr;
+
+		key.assign(digits, end);
+		return;
+	}
+
+	check_string_size(n);
+	key.assign(reinterpret_cast<const char *>(take(n)), n);
+}
+
+template <typename Visitor>
+inline void basic_reader<Visitor>::check_string_size(uint64_t n)
+{
+	if (n > limits.max_string_bytes)
+		throw limit_exceeded(limit::string_bytes, limits.max_string_bytes);
+}
+
+extern template class basic_reader<data_visitor>;
+
+} // namespace serial::msgpack
+
+#endif // SERIAL_MSGPACK_H
@@ -0,0 +1,294 @@
+#include "pointer.h"
+
+#include <stdexcept>
+
+namespace serial {
+
+namespace {
+
+// RFC 6901 array indices: "0", or digits without a leading zero
+uint64_t parse_index(std::string_view key, uint64_t invalid)
+{
+	if (key.empty() || key.size() > 19 || (key[0] == '0' && key.size() > 1))
+		return invalid;
+
+	uint64_t index = 0;
+
+	for (char c : key)
+	{
+		if (c < '0' || c > '9')
+			return invalid;
+
+		index = index * 10 + (c - '0');
+	}
+
+	return index;
+}
+
+// Element index of a packed array.  Unless it has been unpacked, the
+// element has no value of its own to point at, so the result holds a copy.
+found_value packed_element(const packed_array & a, uint64_t index)
+{
+	if (index >= a.size())
+		return found_value();
+
+	if (auto unpacked = a.unpacked())
+		return &(*unpacked)[index];
+
+	return found_value(a.at(index));
+}
+
+} // namespace
+
+pointer::pointer()
+  : text()
+  , tokens()
+	{ }
+
+pointer::pointer(std::string_view escaped)
+  : text(escaped)
+  , tokens()
+{
+	if (escaped.empty())
+		return;
+
+	if (escaped[0] != '/')
+		throw std::runtime_error("JSON pointer must start with '/': "
+		                         + std::string(escaped));
+
+	std::string key;
+
+	for (size_t i = 1; i <= escaped.size(); ++i)
+	{
+		if (i == escaped.size() || escaped[i] == '/')
+		{
+			add_token(std::move(key));
+			key.clear();
+		} else if (escaped[i] == '~')
+		{
+			if (i + 1 < escaped.size() && escaped[i + 1] == '0')
+				key.push_back('~');
+			else if (i + 1 < escaped.size() && escaped[i + 1] == '1')
+				key.push_back('/');
+			else
+				throw std::runtime_error("bad escape in JSON pointer: "
+				                         + std::string(escaped));
+			++i;
+		} else
+		{
+			key.push_back(escaped[i]);
+		}
+	}
+}
+
+pointer pointer::from_path(const path & p)
+{
+	pointer result;
+
+	for (const auto & element : p)
+	{
+		if (std::holds_alternative<std::string>(element))
+		{
+			const auto & key = std::get<std::string>(element);
+			append_pointer_token(result.text, key);
+			result.add_token(key);
+		} else
+		{
+			auto key = std::to_string(std::get<uint64_t>(element));
+			result.text.push_back('/');
+			result.text += key;
+			result.add_token(std::move(key));
+		}
+	}
+
+	return result;
+}
+
+void pointer::add_token(std::string key)
+{
+	uint64_t index = parse_index(key, not_an_index);
+	tokens.push_back(token{std::move(key), index});
+}
+
+const value * pointer::step(const value & v, const token & t)
+{
+	if (std::holds_alternative<value::object_ptr_type>(v.datum))
+	{
+		const auto & o = std::get<value::object_ptr_type>(v.datum);
+
+		if ( ! o)
+			return nullptr;
+
+		auto found = o->find(t.key);
+
+		if (found == o->end())
+			return nullptr;
+
+		return &found->second;
+	} else if (std::holds_alternative<value::array_ptr_type>(v.datum))
+	{
+		const auto & a = std::get<value::array_ptr_type>(v.datum);
+
+		if ( ! a || t.index >= a->size())
+			return nullptr;
+
+		return &(*a)[t.index];
+	} else if (v.is_packed_array())
+	{
+		// Still packed, the elements are scalars that a further token
+		// can't apply to; resolve() deals with a last one
+		auto a = std::get<value::packed_array_ptr_type>(v.datum)->unpacked();
+
+		if ( ! a || t.index >= a->size())
+			return nullptr;
+
+		return &(*a)[t.index];
+	}
+
+	return nullptr;
+}
+
+found_value pointer::resolve(const value & root) const
+{
+	const value * current = &root;
+
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		if (i + 1 == tokens.size() && current->is_packed_array())
+			return packed_element(
+				*std::get<value::packed_array_ptr_type>(current->datum),
+				tokens[i].index);
+
+		if ( ! (current = step(*current, tokens[i])))
+			return found_value();
+	}
+
+	return current;
+}
+
+value * pointer::resolve(value & root) const
+{
+	// Packed arrays along the way are unpacked, so that the result is in
+	// the tree and changes made through it stay there.
+	value * current = &root;
+
+	for (const auto & t : tokens)
+	{
+		if (current->is_packed_array())
+			current->get_array();
+
+		if ( ! (current = const_cast<value *>(step(*current, t))))
+			return nullptr;
+	}
+
+	return current;
+}
+
+void append_pointer_token(std::string & out, std::string_view key)
+{
+	out.push_back('/');
+
+	for (char c : key)
+	{
+		if (c == '~')
+			out += "~0";
+		else if (c == '/')
+			out += "~1";
+		else
+			out.push_back(c);
+	}
+}
+
+std::string to_pointer(const path & p)
+{
+	std::string result;
+
+	for (const auto & element : p)
+	{
+		if (std::holds_alternative<std::string>(element))
+		{
+			append_pointer_token(result, std::get<std::string>(element));
+		} else
+		{
+			result.push_back('/');
+			result += std::to_string(std::get<uint64_t>(element));
+		}
+	}
+
+	return result;
+}
+
+//////////////////////////////////////////////////////////////////////
+path_index::path_index(const value & root)
+  : nodes()
+{
+	std::string prefix;
+	add(root, prefix);
+}
+
+void path_index::add(const value & v, std::string & prefix)
+{
+	nodes.emplace(prefix, &v);
+
+	size_t length = prefix.size();
+
+	if (std::holds_alternative<value::object_ptr_type>(v.datum))
+	{
+		const auto & o = std::get<value::object_ptr_type>(v.datum);
+
+		if (o)
+			for (const auto & [key, member] : *o)
+			{
+				append_pointer_token(prefix, key);
+				add(member, prefix);
+				prefix.resize(length);
+			}
+	} else if (std::holds_alternative<value::array_ptr_type>(v.datum))
+	{
+		const auto & a = std::get<value::array_ptr_type>(v.datum);
+
+		if (a)
+			for (size_t i = 0; i < a->size(); ++i)
+			{
+				prefix.push_back('/');
+				prefix += std::to_string(i);
+				add((*a)[i], prefix);
+				prefix.resize(length);
+			}
+	} else if (v.is_packed_array())
+	{
+		// Scalar elements are found through the array; see find()
+		if (auto a = std::get<value::packed_array_ptr_type>(v.datum)->unpacked())
+			for (size_t i = 0; i < a->size(); ++i)
+			{
+				prefix.push_back('/');
+				prefix += std::to_string(i);
+				add((*a)[i], prefix);
+				prefix.resize(length);
+			}
+	}
+}
+
+found_value path_index::find(std::string_view pointer_text) const
+{
+	auto found = nodes.find(pointer_text);
+
+	if (found != nodes.end())
+		return found->second;
+
+	size_t slash = pointer_text.rfind('/');
+
+	if (slash == std::string_view::npos)
+		return found_value();
+
+	auto parent = nodes.find(pointer_text.substr(0, slash));
+
+	if (parent == nodes.end() || ! parent->second->is_packed_array())
+		return found_value();
+
+	return packed_element(
+		*std::get<value::packed_array_ptr_type>(parent->second->datum),
+		parse_index(pointer_text.substr(slash + 1), pointer::not_an_index));
+}
+
+} // namespace serial
@@ -0,0 +1,136 @@
+#ifndef SERIAL_POINTER_H
+#define SERIAL_POINTER_H 1
+
+#include <cstdint>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "data_visitor.h"
+
+namespace serial {
+
+// What a lookup found: a node of the tree, or, for an element of a packed
+// array, which has no node of its own, a copy of the element held here.
+// Either stays valid for as long as the result and the tree both live.
+class found_value
+{
+ public:
+	found_value() : node(nullptr), element() { }
+
+	found_value(const value * node) : node(node), element() { }
+
+	explicit found_value(value copy)
+	  : node(nullptr), element(std::move(copy)) { }
+
+	explicit operator bool () const { return node || element; }
+
+	const value * get() const { return element ? &*element : node; }
+
+	const value & operator * () const { return *get(); }
+
+	const value * operator -> () const { return get(); }
+
+	// Whether this holds a copy rather than pointing into the tree
+	bool is_copy() const { return element.has_value(); }
+
+ private:
+	const value * node;
+	std::optional<value> element;
+};
+
+// A JSON Pointer (RFC 6901), split and unescaped once so that resolving it
+// only does hash lookups and index checks.  Resolution never modifies the
+// tree or the pointer, so any number of threads may share one.  An element
+// of a packed array resolves to a copy of it; resolving against a mutable
+// tree unpacks the array instead.
+class pointer
+{
+ public:
+	// The empty pointer, referring to the whole document
+	pointer();
+
+	// Throws std::runtime_error if text is neither empty nor starts with
+	// '/', or holds a '~' not followed by '0' or '1'.
+	explicit pointer(std::string_view text);
+
+	static pointer from_path(const path & p);
+
+	// Empty if a member or element along the way is missing, or a token
+	// is applied to a scalar
+	found_value resolve(const value & root) const;
+
+	value * resolve(value & root) const;
+
+	size_t size() const { return tokens.size(); }
+
+	bool empty() const { return tokens.empty(); }
+
+	// The unescaped reference token at position i
+	const std::string & key(size_t i) const { return tokens[i].key; }
+
+	// The token as an array index, or not_an_index
+	uint64_t index(size_t i) const { return tokens[i].index; }
+
+	// The escaped form
+	const std::string & str() const { return text; }
+
+	static constexpr uint64_t not_an_index = ~uint64_t(0);
+
+ private:
+	struct token
+	{
+		std::string key;
+		// key as an array index, if it is one
+		uint64_t index;
+	};
+
+	static const value * step(const value & v, const token & t);
+
+	void add_token(std::string key);
+
+	std::string text;
+	std::vector<token> tokens;
+};
+
+// Appends one reference token to a pointer string, escaping '~' and '/'.
+void append_pointer_token(std::string & out, std::string_view key);
+
+std::string to_pointer(const path & p);
+
+// Every node of a document under its pointer string, for constant-time
+// lookups of deep paths.  The index is built once and never changes, so
+// concurrent readers need no locking; it refers into the tree, which must
+// outlive it and not be modified.  Elements of packed arrays are not
+// stored, but looked up through their array, as pointer::resolve() does.
+class path_index
+{
+ public:
+	explicit path_index(const value & root);
+
+	found_value find(std::string_view pointer_text) const;
+
+	found_value find(const pointer & p) const { return find(p.str()); }
+
+	size_t size() const { return nodes.size(); }
+
+ private:
+	struct hash
+	{
+		using is_transparent = void;
+
+		size_t operator () (std::string_view s) const
+			{ return std::hash<std::string_view>()(s); }
+	};
+
+	void add(const value & v, std::string & prefix);
+
+	std::unordered_map<std::string, const value *, hash, std::equal_to<>> nodes;
+};
+
+} // namespace serial
+
+#endif // SERIAL_POINTER_H
@@ -0,0 +1,151 @@
+#include "snapshot.h"
+
+#include <stdexcept>
+
+namespace serial {
+
+namespace {
+
+[[noreturn]] void missing(const pointer & p, size_t depth)
+{
+	throw std::runtime_error("nothing at '" + p.key(depth) + "' in " + p.str());
+}
+
+enum class edit
+{
+	replace,
+	insert,
+	remove,
+};
+
+// A copy of node with the edit applied at p[depth..].  Only the containers
+// along p are copied; their other members are shared.
+value rebuild(const value & node, const pointer & p, size_t depth,
+              edit how, value * replacement)
+{
+	value result;
+	bool last = depth + 1 == p.size();
+
+	if (std::holds_alternative<value::object_ptr_type>(node.datum))
+	{
+		const auto & original = std::get<value::object_ptr_type>(node.datum);
+		auto copy = original ? std::make_shared<value::object_type>(*original)
+		                     : std::make_shared<value::object_type>();
+		auto found = copy->find(p.key(depth));
+
+		if (last && how == edit::remove)
+		{
+			if (found == copy->end())
+				missing(p, depth);
+
+			copy->erase(found);
+		} else if (last)
+		{
+			(*copy)[p.key(depth)] = std::move(*replacement);
+		} else
+		{
+			if (found == copy->end())
+				missing(p, depth);
+
+			found->second = rebuild(found->second, p, depth + 1, how, replacement);
+		}
+
+		result.datum = std::move(copy);
+	} else if (node.is_array())
+	{
+		std::shared_ptr<value::array_type> copy;
+
+		// An edited packed array comes out generic
+		if (node.is_packed_array())
+		{
+			copy = std::make_shared<value::array_type>(
+				std::get<value::packed_array_ptr_type>(node.datum)->unpack());
+		} else
+		{
+			const auto & original = std::get<value::array_ptr_type>(node.datum);
+			copy = original ? std::make_shared<value::array_type>(*original)
+			                : std::make_shared<value::array_type>();
+		}
+
+		uint64_t index = p.key(depth) == "-" ? copy->size() : p.index(depth);
+
+		if (last && how != edit::remove && index == copy->size())
+			copy->push_back(std::move(*replacement));
+		else if (index >= copy->size())
+			missing(p, depth);
+		else if (last && how == edit::replace)
+			(*copy)[index] = std::move(*replacement);
+		else if (last && how == edit::insert)
+			copy->insert(copy->begin() + index, std::move(*replacement));
+		else if (last)
+			copy->erase(copy->begin() + index);
+		else
+			(*copy)[index] = rebuild((*copy)[index], p, depth + 1, how, replacement);
+
+		result.datum = std::move(copy);
+	} else
+	{
+		missing(p, depth);
+	}
+
+	return result;
+}
+
+} // namespace
+
+snapshot::snapshot()
+  : root_value(std::make_shared<const value>())
+	{ }
+
+snapshot::snapshot(value root)
+  : root_value(std::make_shared<const value>(std::move(root)))
+	{ }
+
+snapshot::snapshot(std::shared_ptr<const value> root)
+  : root_value(std::move(root))
+	{ }
+
+snapshot snapshot::with(const pointer & p, value v) const
+{
+	if (p.empty())
+		return snapshot(std::move(v));
+
+	return snapshot(rebuild(*root_value, p, 0, edit::replace, &v));
+}
+
+snapshot snapshot::inserted(const pointer & p, value v) const
+{
+	if (p.empty())
+		return snapshot(std::move(v));
+
+	return snapshot(rebuild(*root_value, p, 0, edit::insert, &v));
+}
+
+snapshot snapshot::without(const pointer & p) const
+{
+	if (p.empty())
+		throw std::runtime_error("cannot remove the whole document");
+
+	return snapshot(rebuild(*root_value, p, 0, edit::remove, nullptr));
+}
+
+//////////////////////////////////////////////////////////////////////
+snapshot_holder::snapshot_holder()
+  : current(snapshot().root_value)
+	{ }
+
+snapshot_holder::snapshot_holder(snapshot initial)
+  : current(std::move(initial.root_value))
+	{ }
+
+snapshot snapshot_holder::load() const
+{
+	return snapshot(current.load());
+}
+
+void snapshot_holder::publish(const snapshot & next)
+{
+	current.store(next.root_value);
+}
+
+} // namespace serial
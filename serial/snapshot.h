@@ -0,0 +1,101 @@
+#ifndef SERIAL_SNAPSHOT_H
+#define SERIAL_SNAPSHOT_H 1
+
+#include <atomic>
+#include <memory>
+
+#include "data_visitor.h"
+#include "pointer.h"
+
+namespace serial {
+
+// An immutable document.  Copies are cheap and share the tree; with() and
+// without() return a new snapshot that copies only the containers on the
+// way to the change, sharing every other subtree with the original.
+//
+// The tree is shared, so nothing reachable from root() may be modified,
+// even through the non-const container pointers inside a value.
+class snapshot
+{
+ public:
+	// A document holding just null
+	snapshot();
+
+	explicit snapshot(value root);
+
+	const value & root() const { return *root_value; }
+
+	found_value find(const pointer & p) const { return p.resolve(*root_value); }
+
+	// Replaces the value at p, or adds it if p names a missing object
+	// member, the element one past the end of an array, or "-".  Throws
+	// std::runtime_error if the parent of p does not exist or is a scalar.
+	snapshot with(const pointer & p, value v) const;
+
+	snapshot with(const path & p, value v) const
+		{ return with(pointer::from_path(p), std::move(v)); }
+
+	// As with(), except that an array element is inserted before the one
+	// at p rather than replacing it (JSON Patch "add").
+	snapshot inserted(const pointer & p, value v) const;
+
+	// Removes the object member or array element at p; throws if there is
+	// none.
+	snapshot without(const pointer & p) const;
+
+	// Whether both snapshots share the same root
+	bool same(const snapshot & other) const
+		{ return root_value == other.root_value; }
+
+ private:
+	explicit snapshot(std::shared_ptr<const value> root);
+
+	friend class snapshot_holder;
+
+	std::shared_ptr<const value> root_value;
+};
+
+// The current snapshot of a document that is replaced from time to time,
+// e.g. on a configuration reload.  Readers take a snapshot with load()
+// and keep using it for as long as they like while writers publish new
+// ones; an old tree is freed when its last reader lets go.
+class snapshot_holder
+{
+ public:
+	snapshot_holder();
+
+	explicit snapshot_holder(snapshot initial);
+
+	snapshot load() const;
+
+	void publish(const snapshot & next);
+
+	// Applies f to the current snapshot and publishes the result, retrying
+	// if another writer published in between; returns what was published.
+	template <typename F>
+	snapshot update(F && f);
+
+ private:
+	// Writers build the next tree before they swap it in, so readers never
+	// block on a rebuild.  The swap itself is not lock-free: libstdc++
+	// guards it, and load(), with a brief internal lock.
+	std::atomic<std::shared_ptr<const value>> current;
+};
+
+template <typename F>
+snapshot snapshot_holder::update(F && f)
+{
+	auto expected = current.load();
+
+	for (;;)
+	{
+		snapshot next = f(snapshot(expected));
+
+		if (current.compare_exchange_weak(expected, next.root_value))
+			return next;
+	}
+}
+
+} // namespace serial
+
+#endif // SERIAL_SNAPSHOT_H
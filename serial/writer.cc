@@ -0,0 +1,453 @@
+#include "writer.h"
+
+#include <charconv>
+#include <cmath>
+#include <ostream>
+#include <stdexcept>
+
+#include "util/fp_convert.h"
+#include "util/scan.h"
+
+namespace serial {
+
+void append_quoted(std::string & out, std::string_view s)
+{
+	static constexpr char hex[] = "0123456789abcdef";
+
+	out.push_back('"');
+
+	const char * end = s.data() + s.size();
+	const char * plain = s.data();
+
+	for (const char * p; (p = util::skip_unescaped(plain, end)) != end; )
+	{
+		unsigned char c = *p;
+
+		out.append(plain, p);
+		plain = p + 1;
+
+		switch (c)
+		{
+		 case '"': out += "\\\""; break;
+		 case '\\': out += "\\\\"; break;
+		 case '\b': out += "\\b"; break;
+		 case '\f': out += "\\f"; break;
+		 case '\n': out += "\\n"; break;
+		 case '\r': out += "\\r"; break;
+		 case '\t': out += "\\t"; break;
+		 default:
+			out += "\\u00";
+			out.push_back(hex[c >> 4]);
+			out.push_back(hex[c & 0xf]);
+			break;
+		}
+	}
+
+	out.append(plain, end);
+	out.push_back('"');
+}
+
+void append_number(std::string & out, int64_t n)
+{
+	char digits[24];
+	out.append(digits, std::to_chars(digits, digits + sizeof digits, n).ptr);
+}
+
+void append_number(std::string & out, uint64_t n)
+{
+	char digits[24];
+	out.append(digits, std::to_chars(digits, digits + sizeof digits, n).ptr);
+}
+
+void append_number(std::string & out, double d)
+{
+	if ( ! std::isfinite(d))
+		throw std::runtime_error("JSON cannot represent NaN or infinity");
+
+	// Including -0
+	if (d == 0)
+	{
+		out.push_back('0');
+		return;
+	}
+
+	char digits[32];
+	out.append(digits, util::fp_convert(d, digits));
+}
+
+//////////////////////////////////////////////////////////////////////
+writer::writer(std::ostream & o, const writer_options & opts)
+  : out(o)
+  , options(opts)
+  , buffer()
+  , levels()
+  , done(false)
+{
+	buffer.reserve(options.buffer_size + 1024);
+}
+
+writer::~writer()
+{
+	try
+	{
+		flush();
+	} catch (...)
+	{
+	}
+}
+
+void writer::flush()
+{
+	out.write(buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+void writer::indent(size_t n)
+{
+	buffer.push_back('\n');
+	buffer.append(n, '\t');
+}
+
+void writer::before_value()
+{
+	if (levels.empty())
+	{
+		if (done)
+			throw std::runtime_error("writer: more than one top-level value");
+
+		done = true;
+		return;
+	}
+
+	level & l = levels.back();
+
+	if (l.object)
+	{
+		if ( ! l.have_key)
+			throw std::runtime_error("writer: object member without a key");
+
+		l.have_key = false;
+		return;
+	}
+
+	if (l.count++)
+		buffer.push_back(',');
+
+	if (options.pretty)
+		indent(levels.size());
+}
+
+void writer::key(std::string_view k)
+{
+	if (levels.empty() || ! levels.back().object)
+		throw std::runtime_error("writer: key outside an object");
+
+	level & l = levels.back();
+
+	if (l.have_key)
+		throw std::runtime_error("writer: two keys in a row");
+
+	if (l.count++)
+		buffer.push_back(',');
+
+	if (options.pretty)
+		indent(levels.size());
+
+	append_quoted(buffer, k);
+	buffer += options.pretty ? ": " : ":";
+	l.have_key = true;
+
+	maybe_flush();
+}
+
+void writer::begin_object()
+{
+	before_value();
+	buffer.push_back('{');
+	levels.push_back(level{true, false, 0});
+}
+
+void writer::begin_array()
+{
+	before_value();
+	buffer.push_back('[');
+	levels.push_back(level{false, false, 0});
+}
+
+void writer::end(bool object)
+{
+	if (levels.empty() || levels.back().object != object)
+		throw std::runtime_error(object ? "writer: end_object without an object"
+		                                : "writer: end_array without an array");
+
+	if (levels.back().have_key)
+		throw std::runtime_error("writer: key without a value");
+
+	size_t count = levels.back().count;
+	levels.pop_back();
+
+	if (options.pretty)
+	{
+		if (count)
+			indent(levels.size());
+		else
+			buffer.push_back(' ');
+	}
+
+	buffer.push_back(object ? '}' : ']');
+	maybe_flush();
+}
+
+void writer::end_object()
+{
+	end(true);
+}
+
+void writer::end_array()
+{
+	end(false);
+}
+
+void writer::null()
+{
+	before_value();
+	buffer += "null";
+	maybe_flush();
+}
+
+void writer::boolean(bool b)
+{
+	before_value();
+	buffer += b ? "true" : "false";
+	maybe_flush();
+}
+
+void writer::number(int64_t n)
+{
+	before_value();
+	append_number(buffer, n);
+	maybe_flush();
+}
+
+void writer::number(uint64_t n)
+{
+	before_value();
+	append_number(buffer, n);
+	maybe_flush();
+}
+
+void writer::number(double d)
+{
+	before_value();
+	append_number(buffer, d);
+	maybe_flush();
+}
+
+void writer::number(const big_number & n)
+{
+	before_value();
+	buffer += n.text;
+	maybe_flush();
+}
+
+void writer::string(std::string_view s)
+{
+	before_value();
+	append_quoted(buffer, s);
+	maybe_flush();
+}
+
+void writer::write(const value & v)
+{
+	if (std::holds_alternative<std::string>(v.datum))
+	{
+		string(std::get<std::string>(v.datum));
+	} else if (std::holds_alternative<int64_t>(v.datum))
+	{
+		number(std::get<int64_t>(v.datum));
+	} else if (std::holds_alternative<uint64_t>(v.datum))
+	{
+		number(std::get<uint64_t>(v.datum));
+	} else if (std::holds_alternative<double>(v.datum))
+	{
+		number(std::get<double>(v.datum));
+	} else if (std::holds_alternative<big_number>(v.datum))
+	{
+		number(std::get<big_number>(v.datum));
+	} else if (std::holds_alternative<bool>(v.datum))
+	{
+		boolean(std::get<bool>(v.datum));
+	} else if (std::holds_alternative<std::nullptr_t>(v.datum))
+	{
+		null();
+	} else if (std::holds_alternative<value::array_ptr_type>(v.datum))
+	{
+		begin_array();
+
+		if (const auto & a = std::get<value::array_ptr_type>(v.datum))
+			for (const auto & element : *a)
+				write(element);
+
+		end_array();
+	} else if (v.is_packed_array())
+	{
+		begin_array();
+
+		std::get<value::packed_array_ptr_type>(v.datum)->for_each([&](auto x) {
+			if constexpr (std::is_same_v<decltype(x), value>)
+				write(x);
+			else if constexpr (std::is_same_v<decltype(x), bool>)
+				boolean(x);
+			else
+				number(x);
+		});
+
+		end_array();
+	} else if (std::holds_alternative<value::object_ptr_type>(v.datum))
+	{
+		begin_object();
+
+		if (const auto & o = std::get<value::object_ptr_type>(v.datum))
+			for (const auto & [k, member] : *o)
+			{
+				key(k);
+				write(member);
+			}
+
+		end_object();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+writer_visitor::writer_visitor(writer & w)
+  : data_visitor()
+  , out(w)
+  , open()
+	{ }
+
+void writer_visitor::move_to(const path & p)
+{
+	size_t common = 0;
+
+	while (common < open.size() && common < p.size() && open[common] == p[common])
+		++common;
+
+	// The same member again, i.e. a duplicate key
+	if (common == p.size() && common > 0)
+		--common;
+
+	while (open.size() > common + 1)
+	{
+		if (std::holds_alternative<std::string>(open.back()))
+			out.end_object();
+		else
+			out.end_array();
+
+		open.pop_back();
+	}
+
+	size_t next = open.size();
+
+	if (open.size() == common + 1 && common < p.size())
+	{
+		if (open[common].index() != p[common].index())
+			throw std::runtime_error("writer_visitor: path switches between "
+			                         "object and array");
+
+		if (std::holds_alternative<std::string>(p[common]))
+			out.key(std::get<std::string>(p[common]));
+
+		open[common] = p[common];
+		next = common + 1;
+	}
+
+	for (size_t d = next; d < p.size(); ++d)
+	{
+		if (std::holds_alternative<std::string>(p[d]))
+		{
+			out.begin_object();
+			out.key(std::get<std::string>(p[d]));
+		} else
+		{
+			out.begin_array();
+		}
+
+		open.push_back(p[d]);
+	}
+}
+
+void writer_visitor::add_datum(const path & p, const empty_array &)
+{
+	move_to(p);
+	out.begin_array();
+	out.end_array();
+}
+
+void writer_visitor::add_datum(const path & p, const empty_object &)
+{
+	move_to(p);
+	out.begin_object();
+	out.end_object();
+}
+
+void writer_visitor::add_datum(const path & p, std::nullptr_t)
+{
+	move_to(p);
+	out.null();
+}
+
+void writer_visitor::add_datum(const path & p, bool datum)
+{
+	move_to(p);
+	out.boolean(datum);
+}
+
+void writer_visitor::add_datum(const path & p, int64_t datum)
+{
+	move_to(p);
+	out.number(datum);
+}
+
+void writer_visitor::add_datum(const path & p, uint64_t datum)
+{
+	move_to(p);
+	out.number(datum);
+}
+
+void writer_visitor::add_datum(const path & p, double datum)
+{
+	move_to(p);
+	out.number(datum);
+}
+
+void writer_visitor::add_datum(const path & p, std::string && datum)
+{
+	move_to(p);
+	out.string(datum);
+}
+
+void writer_visitor::add_datum(const path & p, big_number && datum)
+{
+	move_to(p);
+	out.number(datum);
+}
+
+void writer_visitor::finish()
+{
+	path root;
+	move_to(root);
+
+	if ( ! open.empty())
+	{
+		if (std::holds_alternative<std::string>(open.back()))
+			out.end_object();
+		else
+			out.end_array();
+
+		open.pop_back();
+	}
+
+	out.flush();
+}
+
+} // namespace serial
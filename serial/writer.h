@@ -0,0 +1,151 @@
+#ifndef SERIAL_WRITER_H
+#define SERIAL_WRITER_H 1
+
+#include <cstdint>
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "data_visitor.h"
+
+namespace serial {
+
+// Appends s as a JSON string, escaping only what JSON requires.
+void append_quoted(std::string & out, std::string_view s);
+
+void append_number(std::string & out, int64_t n);
+
+void append_number(std::string & out, uint64_t n);
+
+// Shortest round-trip form; throws std::runtime_error for NaN and
+// infinities.
+void append_number(std::string & out, double d);
+
+struct writer_options
+{
+	// Tab-indented like value::print, otherwise no whitespace at all
+	bool pretty = false;
+
+	// Output is handed to the stream in pieces of about this size
+	size_t buffer_size = 64 * 1024;
+};
+
+// Writes JSON as a sequence of calls, without building a tree.  Nesting
+// is checked as it goes: a key outside an object, a value where a key is
+// expected, a mismatched end or a second top-level value throw
+// std::runtime_error.
+class writer
+{
+ public:
+	writer(std::ostream & out, const writer_options & options = writer_options());
+
+	// Flushes what is buffered, but does not close open containers.
+	~writer();
+
+	void begin_object();
+
+	void end_object();
+
+	void begin_array();
+
+	void end_array();
+
+	void key(std::string_view k);
+
+	void null();
+
+	void boolean(bool b);
+
+	void number(int64_t n);
+
+	void number(uint64_t n);
+
+	void number(double d);
+
+	// Written out as is
+	void number(const big_number & n);
+
+	void string(std::string_view s);
+
+	// A whole tree, in unordered_map order
+	void write(const value & v);
+
+	// Whether one complete top-level value has been written
+	bool complete() const { return done && levels.empty(); }
+
+	size_t depth() const { return levels.size(); }
+
+	void flush();
+
+ private:
+	struct level
+	{
+		bool object;
+		// An object has had its key and is waiting for the value
+		bool have_key;
+		size_t count;
+	};
+
+	// Separator and indentation before a value; checks that a value may
+	// go here.
+	void before_value();
+
+	void end(bool object);
+
+	void indent(size_t n);
+
+	void maybe_flush()
+		{ if (buffer.size() >= options.buffer_size) flush(); }
+
+	std::ostream & out;
+	writer_options options;
+	std::string buffer;
+	std::vector<level> levels;
+	bool done;
+};
+
+// Feeds parser events to a writer, turning paths back into nesting, so a
+// document can be reformatted or filtered as it is parsed without ever
+// holding it in memory.  Call finish() after the parse to close the
+// containers still open.
+class writer_visitor : public data_visitor
+{
+ public:
+	writer_visitor(writer & w);
+
+	using data_visitor::add_datum;
+
+	void add_datum(const path & p, const empty_array &) override;
+
+	void add_datum(const path & p, const empty_object &) override;
+
+	void add_datum(const path & p, std::nullptr_t) override;
+
+	void add_datum(const path & p, bool datum) override;
+
+	void add_datum(const path & p, int64_t datum) override;
+
+	void add_datum(const path & p, uint64_t datum) override;
+
+	void add_datum(const path & p, double datum) override;
+
+	void add_datum(const path & p, std::string && datum) override;
+
+	void add_datum(const path & p, big_number && datum) override;
+
+	void finish();
+
+ private:
+	// Closes and opens containers so the writer is positioned at p.
+	void move_to(const path & p);
+
+	writer & out;
+	// The member of each open container that is being written
+	path open;
+};
+
+} // namespace serial
+
+#endif // SERIAL_WRITER_H
@@ -0,0 +1,490 @@
+#include "compressed_stream.h"
+
+#include <unistd.h>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "error_handling.h"
+
+namespace util {
+
+compression detect_compression(const void * data, size_t n)
+{
+	const unsigned char * p = static_cast<const unsigned char *>(data);
+
+	if (n >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+		return compression::gzip;
+
+	if (n >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+		return compression::zstd;
+
+	return compression::none;
+}
+
+namespace {
+
+void write_all(int fd, const char * data, size_t n)
+{
+	while (n > 0)
+	{
+		ssize_t rc = ::write(fd, data, n);
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			throw_errno("Could not write compressed data");
+		}
+
+		data += rc;
+		n -= rc;
+	}
+}
+
+class gzip_decompressor : public decompressor
+{
+ public:
+	gzip_decompressor() : stream(), end_of_member(false)
+	{
+		// 15 + 32: any window size, gzip or zlib header
+		if (inflateInit2(&stream, 15 + 32) != Z_OK)
+			throw std::runtime_error("inflateInit2 failed");
+	}
+
+	~gzip_decompressor() { inflateEnd(&stream); }
+
+	size_t decompress(const char * in, size_t n, size_t & in_used,
+	                  char * out, size_t out_n) override
+	{
+		// Concatenated gzip members are legal and produced by e.g. pigz
+		if (end_of_member && n > 0)
+		{
+			inflateReset(&stream);
+			end_of_member = false;
+		}
+
+		stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+		stream.avail_in = n;
+		stream.next_out = reinterpret_cast<Bytef *>(out);
+		stream.avail_out = out_n;
+
+		int rc = inflate(&stream, Z_NO_FLUSH);
+
+		if (rc == Z_STREAM_END)
+			end_of_member = true;
+		else if (rc != Z_OK && rc != Z_BUF_ERROR)
+			throw std::runtime_error(std::string("gzip: ")
+			                         + (stream.msg ? stream.msg
+			                                       : "corrupt stream"));
+
+		in_used = n - stream.avail_in;
+		return out_n - stream.avail_out;
+	}
+
+	bool at_end() const override { return end_of_member; }
+
+ private:
+	z_stream stream;
+	bool end_of_member;
+};
+
+class zstd_decompressor : public decompressor
+{
+ public:
+	zstd_decompressor() : stream(ZSTD_createDStream()), end_of_frame(true)
+	{
+		if (stream == nullptr)
+			throw std::runtime_error("ZSTD_createDStream failed");
+
+		ZSTD_initDStream(stream);
+	}
+
+	~zstd_decompressor() { ZSTD_freeDStream(stream); }
+
+	size_t decompress(const char * in, size_t n, size_t & in_used,
+	                  char * out, size_t out_n) override
+	{
+		ZSTD_inBuffer input = { in, n, 0 };
+		ZSTD_outBuffer output = { out, out_n, 0 };
+
+		size_t rc = ZSTD_decompressStream(stream, &output, &input);
+
+		if (ZSTD_isError(rc))
+			throw std::runtime_error(std::string("zstd: ")
+			                         + ZSTD_getErrorName(rc));
+
+		// rc == 0 means a frame was completely decoded and flushed
+		end_of_frame = (rc == 0) || (end_of_frame && output.pos == 0);
+
+		in_used = input.pos;
+		return output.pos;
+	}
+
+	bool at_end() const override { return end_of_frame; }
+
+ private:
+	ZSTD_DStream * stream;
+	bool end_of_frame;
+};
+
+class gzip_compressor : public compressor
+{
+ public:
+	gzip_compressor(int level) : stream(), buffer(64 * 1024)
+	{
+		if (level < 0)
+			level = Z_DEFAULT_COMPRESSION;
+
+		// 15 + 16: gzip header rather than zlib
+		if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+		                 Z_DEFAULT_STRATEGY) != Z_OK)
+			throw std::runtime_error("deflateInit2 failed");
+	}
+
+	~gzip_compressor() { deflateEnd(&stream); }
+
+	void compress(const char * in, size_t n, bool finish,
+	              const file_descriptor & out) override
+	{
+		stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+		stream.avail_in = n;
+
+		int rc;
+
+		do {
+			stream.next_out = reinterpret_cast<Bytef *>(buffer.data());
+			stream.avail_out = buffer.size();
+
+			rc = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+
+			if (rc == Z_STREAM_ERROR)
+				throw std::runtime_error("gzip: deflate failed");
+
+			write_all(out, buffer.data(), buffer.size() - stream.avail_out);
+		} while (stream.avail_out == 0 || (finish && rc != Z_STREAM_END));
+	}
+
+ private:
+	z_stream stream;
+	std::vector<char> buffer;
+};
+
+class zstd_compressor : public compressor
+{
+ public:
+	zstd_compressor(int level)
+	  : context(ZSTD_createCCtx())
+	  , buffer(ZSTD_CStreamOutSize())
+	{
+		if (context == nullptr)
+			throw std::runtime_error("ZSTD_createCCtx failed");
+
+		if (level >= 0)
+			ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+	}
+
+	~zstd_compressor() { ZSTD_freeCCtx(context); }
+
+	void compress(const char * in, size_t n, bool finish,
+	              const file_descriptor & out) override
+	{
+		ZSTD_inBuffer input = { in, n, 0 };
+		ZSTD_EndDirective mode = finish ? ZSTD_e_end : ZSTD_e_continue;
+		size_t remaining;
+
+		do {
+			ZSTD_outBuffer output = { buffer.data(), buffer.size(), 0 };
+
+			remaining = ZSTD_compressStream2(context, &output, &input, mode);
+
+			if (ZSTD_isError(remaining))
+				throw std::runtime_error(std::string("zstd: ")
+				                         + ZSTD_getErrorName(remaining));
+
+			write_all(out, buffer.data(), output.pos);
+		} while (finish ? remaining != 0 : input.pos != input.size);
+	}
+
+ private:
+	ZSTD_CCtx * context;
+	std::vector<char> buffer;
+};
+
+} // anonymous namespace
+
+std::unique_ptr<decompressor> decompressor::create(compression type)
+{
+	switch (type)
+	{
+	 case compression::gzip: return std::make_unique<gzip_decompressor>();
+	 case compression::zstd: return std::make_unique<zstd_decompressor>();
+	 default:
+		throw std::runtime_error("no decompressor for uncompressed data");
+	}
+}
+
+std::unique_ptr<compressor> compressor::create(compression type, int level)
+{
+	switch (type)
+	{
+	 case compression::gzip: return std::make_unique<gzip_compressor>(level);
+	 case compression::zstd: return std::make_unique<zstd_compressor>(level);
+	 default:
+		throw std::runtime_error("no compressor for uncompressed data");
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+decompressing_reader::decompressing_reader(compression type,
+                                           const char * prefix,
+                                           size_t prefix_len,
+                                           int fd)
+  : codec(decompressor::create(type))
+  , prefix(prefix)
+  , prefix_len(prefix_len)
+  , fd(fd)
+  , chunks(chunk_count)
+  , free_chunks()
+  , full_chunks()
+  , current(nullptr)
+  , lock()
+  , changed()
+  , error()
+  , done(false)
+  , cancelled(false)
+  , worker()
+{
+	for (auto & c : chunks)
+	{
+		c.data.resize(chunk_size);
+		c.size = 0;
+		free_chunks.push_back(&c);
+	}
+
+	worker = std::thread(&decompressing_reader::run, this);
+}
+
+decompressing_reader::~decompressing_reader()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		cancelled = true;
+	}
+
+	changed.notify_all();
+	worker.join();
+}
+
+size_t decompressing_reader::next(const char * & data)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	if (current)
+	{
+		free_chunks.push_back(current);
+		current = nullptr;
+		changed.notify_all();
+	}
+
+	changed.wait(guard, [&]{ return ! full_chunks.empty() || done; });
+
+	if (full_chunks.empty())
+	{
+		if (error)
+			std::rethrow_exception(error);
+
+		return 0;
+	}
+
+	current = full_chunks.front();
+	full_chunks.pop_front();
+
+	data = current->data.data();
+	return current->size;
+}
+
+void decompressing_reader::run()
+{
+	try {
+		produce();
+	} catch (...)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		error = std::current_exception();
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+
+	changed.notify_all();
+}
+
+decompressing_reader::chunk * decompressing_reader::get_free_chunk()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	changed.wait(guard, [&]{ return ! free_chunks.empty() || cancelled; });
+
+	if (cancelled)
+		return nullptr;
+
+	chunk * c = free_chunks.front();
+	free_chunks.pop_front();
+	c->size = 0;
+
+	return c;
+}
+
+void decompressing_reader::push_full_chunk(chunk * c)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		full_chunks.push_back(c);
+	}
+
+	changed.notify_all();
+}
+
+void decompressing_reader::produce()
+{
+	std::vector<char> input;
+	const char * in = prefix;
+	size_t in_n = prefix_len;
+	bool eof = (fd < 0);
+
+	chunk * out = get_free_chunk();
+
+	while (out)
+	{
+		if (in_n == 0 && ! eof)
+		{
+			input.resize(chunk_size);
+
+			ssize_t n = ::read(fd, input.data(), input.size());
+
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				throw_errno("Could not read compressed data");
+			}
+
+			eof = (n == 0);
+			in = input.data();
+			in_n = n;
+		}
+
+		size_t used = 0;
+		size_t produced = codec->decompress(in, in_n, used,
+		                                    out->data.data() + out->size,
+		                                    out->data.size() - out->size);
+
+		in += used;
+		in_n -= used;
+		out->size += produced;
+
+		bool full = (out->size == out->data.size());
+		bool finished = (eof && in_n == 0 && produced == 0);
+
+		if (full || (finished && out->size > 0))
+		{
+			push_full_chunk(out);
+			out = finished ? nullptr : get_free_chunk();
+		}
+
+		if (finished)
+		{
+			if ( ! codec->at_end())
+				throw std::runtime_error("compressed stream is truncated");
+
+			break;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+compressing_streambuf::compressing_streambuf(file_descriptor && fd,
+                                             compression type,
+                                             int level)
+  : fd(std::move(fd))
+  , codec(compressor::create(type, level))
+  , buffer(256 * 1024)
+  , closed(false)
+{
+	setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+compressing_streambuf::~compressing_streambuf()
+{
+	try {
+		close();
+	} catch (...)
+	{
+	}
+}
+
+void compressing_streambuf::close()
+{
+	if (closed)
+		return;
+
+	closed = true;
+	flush_buffer(true);
+	fd.close();
+}
+
+compressing_streambuf::int_type compressing_streambuf::overflow(int_type c)
+{
+	if (closed)
+		return traits_type::eof();
+
+	flush_buffer(false);
+
+	if ( ! traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+int compressing_streambuf::sync()
+{
+	if ( ! closed)
+		flush_buffer(false);
+
+	return 0;
+}
+
+void compressing_streambuf::flush_buffer(bool finish)
+{
+	codec->compress(pbase(), pptr() - pbase(), finish, fd);
+	setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+//////////////////////////////////////////////////////////////////////
+compressed_ostream::compressed_ostream(file_descriptor && fd,
+                                       compression type,
+                                       int level)
+  : std::ostream(nullptr)
+  , buf(std::move(fd), type, level)
+{
+	rdbuf(&buf);
+}
+
+void compressed_ostream::close()
+{
+	buf.close();
+}
+
+} // namespace util
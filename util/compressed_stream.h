@@ -0,0 +1,164 @@
+#ifndef UTIL_COMPRESSED_STREAM_H
+#define UTIL_COMPRESSED_STREAM_H 1
+
+#include <cstddef>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "file_descriptor.h"
+
+namespace util {
+
+enum class compression
+{
+	none,
+	gzip,
+	zstd,
+};
+
+// Looks at the leading magic bytes of a stream.  Needs at most 4 bytes.
+compression detect_compression(const void * data, size_t n);
+
+class decompressor
+{
+ public:
+	static std::unique_ptr<decompressor> create(compression type);
+
+	virtual ~decompressor() { }
+
+	// Decompresses as much of [in, in + n) as fits into [out, out + out_n).
+	// Returns the number of output bytes written and advances in_used by
+	// the number of input bytes consumed.
+	virtual size_t decompress(const char * in, size_t n, size_t & in_used,
+	                          char * out, size_t out_n) = 0;
+
+	// True when the last call ended on a complete frame/member boundary.
+	virtual bool at_end() const = 0;
+};
+
+// Runs a decompressor on its own thread, handing decompressed output to
+// the consumer through a small ring of fixed-size chunks so that memory
+// stays bounded no matter how large the stream is.  Input is an optional
+// in-memory prefix (e.g. an mmap'd file, or bytes already read while
+// sniffing the magic) followed by whatever can still be read from fd.
+class decompressing_reader
+{
+ public:
+	static constexpr size_t chunk_size = 256 * 1024;
+	static constexpr size_t chunk_count = 4;
+
+	decompressing_reader(compression type,
+	                     const char * prefix, size_t prefix_len,
+	                     int fd = -1);
+
+	decompressing_reader(const decompressing_reader &) = delete;
+
+	decompressing_reader & operator = (const decompressing_reader &) = delete;
+
+	~decompressing_reader();
+
+	// Returns the next chunk of decompressed data, or 0 at end of stream.
+	// The chunk stays valid until the following call.  Errors raised on
+	// the decompression thread are rethrown here.
+	size_t next(const char * & data);
+
+ private:
+	struct chunk
+	{
+		std::vector<char> data;
+		size_t size;
+	};
+
+	void run();
+
+	void produce();
+
+	chunk * get_free_chunk();
+
+	void push_full_chunk(chunk * c);
+
+	std::unique_ptr<decompressor> codec;
+	const char * prefix;
+	size_t prefix_len;
+	int fd;
+
+	std::vector<chunk> chunks;
+	std::deque<chunk *> free_chunks;
+	std::deque<chunk *> full_chunks;
+	chunk * current;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::exception_ptr error;
+	bool done;
+	bool cancelled;
+
+	std::thread worker;
+};
+
+class compressor
+{
+ public:
+	static std::unique_ptr<compressor> create(compression type, int level);
+
+	virtual ~compressor() { }
+
+	// Compresses [in, in + n) and hands the output to write().  When
+	// finish is set, the stream is terminated.
+	virtual void compress(const char * in, size_t n, bool finish,
+	                      const file_descriptor & out) = 0;
+};
+
+class compressing_streambuf : public std::streambuf
+{
+ public:
+	compressing_streambuf(file_descriptor && fd,
+	                      compression type,
+	                      int level = -1);
+
+	~compressing_streambuf();
+
+	// Flushes and terminates the compressed stream.  Called by the
+	// destructor if needed, but errors can only be reported from here.
+	void close();
+
+ protected:
+	int_type overflow(int_type c) override;
+
+	int sync() override;
+
+ private:
+	void flush_buffer(bool finish);
+
+	file_descriptor fd;
+	std::unique_ptr<compressor> codec;
+	std::vector<char> buffer;
+	bool closed;
+};
+
+// An ostream that writes compressed data to a file, suitable for
+// value::print() and friends.
+class compressed_ostream : public std::ostream
+{
+ public:
+	compressed_ostream(file_descriptor && fd,
+	                   compression type,
+	                   int level = -1);
+
+	void close();
+
+ private:
+	compressing_streambuf buf;
+};
+
+} // namespace util
+
+#endif // UTIL_COMPRESSED_STREAM_H
@@ -0,0 +1,94 @@
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace util {
+
+namespace {
+
+simd_level detect()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	// May run before libgcc's own constructor
+	__builtin_cpu_init();
+
+	// These include the check that the OS saves the wider registers
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return simd_level::avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return simd_level::avx2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return simd_level::sse42;
+	if (__builtin_cpu_supports("sse2"))
+		return simd_level::sse2;
+#endif
+
+	return simd_level::scalar;
+}
+
+simd_level initial_level()
+{
+	simd_level level = detected_simd_level();
+
+	if (const char * requested = getenv("SERIAL_SIMD_LEVEL"))
+	{
+		try
+		{
+			level = std::min(level, simd_level_from_string(requested));
+		} catch (const std::invalid_argument & e)
+		{
+			std::cerr << e.what() << ", using " << to_string(level) << '\n';
+		}
+	}
+
+	return level;
+}
+
+} // namespace
+
+const char * to_string(simd_level level)
+{
+	switch (level)
+	{
+	 case simd_level::scalar: return "scalar";
+	 case simd_level::sse2: return "sse2";
+	 case simd_level::sse42: return "sse4.2";
+	 case simd_level::avx2: return "avx2";
+	 case simd_level::avx512: return "avx512";
+	}
+
+	return "unknown";
+}
+
+simd_level simd_level_from_string(std::string_view name)
+{
+	for (auto level : { simd_level::scalar, simd_level::sse2, simd_level::sse42,
+	                     simd_level::avx2, simd_level::avx512 })
+		if (name == to_string(level))
+			return level;
+
+	throw std::invalid_argument("unknown SIMD level '" + std::string(name) + "'");
+}
+
+simd_level detected_simd_level()
+{
+	static const simd_level detected = detect();
+	return detected;
+}
+
+namespace detail {
+std::atomic<simd_level> active_simd_level{initial_level()};
+}
+
+simd_level force_simd_level(simd_level level)
+{
+	level = std::min(level, detected_simd_level());
+	detail::active_simd_level.store(level, std::memory_order_relaxed);
+	return level;
+}
+
+} // namespace util
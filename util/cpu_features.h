@@ -0,0 +1,48 @@
+#ifndef UTIL_CPU_FEATURES_H
+#define UTIL_CPU_FEATURES_H 1
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+namespace util {
+
+// Instruction set levels the vector kernels are written for, in order.
+// SSE2 is part of x86-64 itself; scalar is the portable code every kernel
+// has, and the only level on other architectures.
+enum class simd_level : uint8_t
+{
+	scalar,
+	sse2,
+	sse42,
+	avx2,
+	avx512,
+};
+
+const char * to_string(simd_level level);
+
+// Throws std::invalid_argument for an unknown name
+simd_level simd_level_from_string(std::string_view name);
+
+// What this CPU and OS support
+simd_level detected_simd_level();
+
+namespace detail {
+extern std::atomic<simd_level> active_simd_level;
+}
+
+// The level kernels dispatch on: the detected one, or lower if asked for
+// with SERIAL_SIMD_LEVEL=scalar|sse2|sse4.2|avx2|avx512 in the environment
+// or with force_simd_level().
+inline simd_level simd()
+{
+	return detail::active_simd_level.load(std::memory_order_relaxed);
+}
+
+// For benchmarks and tests; returns the level in effect, which is never
+// above what the CPU supports.
+simd_level force_simd_level(simd_level level);
+
+} // namespace util
+
+#endif // UTIL_CPU_FEATURES_H
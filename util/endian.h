@@ -0,0 +1,49 @@
+#ifndef UTIL_ENDIAN_H
+#define UTIL_ENDIAN_H 1
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace util {
+
+template <typename T>
+T byte_swap(T v)
+{
+	static_assert(std::is_unsigned_v<T>);
+
+	if constexpr (sizeof(T) == 1)
+		return v;
+	else if constexpr (sizeof(T) == 2)
+		return __builtin_bswap16(v);
+	else if constexpr (sizeof(T) == 4)
+		return __builtin_bswap32(v);
+	else
+		return __builtin_bswap64(v);
+}
+
+// An unsigned integer stored most significant byte first, as network
+// protocols and binary serialization formats do
+template <typename T>
+T load_big_endian(const void * p)
+{
+	T v;
+	std::memcpy(&v, p, sizeof v);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = byte_swap(v);
+#endif
+	return v;
+}
+
+template <typename T>
+void store_big_endian(T v, void * p)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	v = byte_swap(v);
+#endif
+	std::memcpy(p, &v, sizeof v);
+}
+
+} // namespace util
+
+#endif // UTIL_ENDIAN_H
@@ -35,10 +35,12 @@
 
 #include <initializer_list>
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <cstring>
 #include <cstdint>
 #include <cstdio>
+#include <stdexcept>
 #include <type_traits>
 
 // This include is also dual-licenced under the LGPL & Boost software license
@@ -462,4 +464,283 @@ int fp_convert(double d, char * dest)
     return str_len + value.negative;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Fixed precision.  Grisu only finds the shortest digits, so these round
+// the exact binary value instead: mantissa * 2^exp * 10^p fits in 128 bits
+// for the values and precisions that matter, and anything else goes to
+// snprintf.
+
+static constexpr std::array<uint128_t, 39> make_powers_ten_128()
+{
+	std::array<uint128_t, 39> p{};
+	p[0] = 1;
+
+	for (size_t i = 1; i < p.size(); ++i)
+		p[i] = p[i - 1] * 10;
+
+	return p;
+}
+
+static constexpr auto tens_128 = make_powers_ten_128();
+
+// q = v / 2^s, rounded half to even
+static uint128_t shift_round(uint128_t v, int s)
+{
+	if (s == 0)
+		return v;
+
+	if (s > 128)
+		return 0;
+
+	if (s == 128)
+		return v > (uint128_t(1) << 127);
+
+	uint128_t q = v >> s;
+	uint128_t r = v & ((uint128_t(1) << s) - 1);
+	uint128_t half = uint128_t(1) << (s - 1);
+
+	if (r > half || (r == half && (q & 1)))
+		++q;
+
+	return q;
+}
+
+// q = mantissa * 2^exp * 10^p rounded half to even, like printf does;
+// false if that does not fit in 128 bits.
+static bool scaled_round(const decomposed & v, int p, uint128_t & q)
+{
+	if (p >= 0)
+	{
+		// 10^22 < 2^74 and the mantissa has 53 bits
+		if (p > fp_max_decimals)
+			return false;
+
+		uint128_t x = v.mantissa * tens_128[p];
+
+		if (v.exp >= 0)
+		{
+			if (v.exp > 127 || (x >> (127 - v.exp)) != 0)
+				return false;
+
+			q = x << v.exp;
+		} else
+		{
+			q = shift_round(x, -v.exp);
+		}
+
+		return true;
+	}
+
+	if (-p >= int(tens_128.size()))
+		return false;
+
+	uint128_t n = v.mantissa;
+	uint128_t d = tens_128[-p];
+
+	if (v.exp >= 0)
+	{
+		if (v.exp > 74)
+			return false;
+
+		n <<= v.exp;
+	} else
+	{
+		if (-v.exp > 127 || (d >> (127 + v.exp)) != 0)
+			return false;
+
+		d <<= -v.exp;
+	}
+
+	q = n / d;
+	uint128_t r = n % d;
+
+	if (r > d - r || (r == d - r && (q & 1)))
+		++q;
+
+	return true;
+}
+
+// Writes q right to left ending at end; returns the first digit
+static char * write_backwards(uint128_t q, char * end)
+{
+	while (q > UINT64_MAX)
+	{
+		*--end = '0' + unsigned(q % 10);
+		q /= 10;
+	}
+
+	uint64_t low = q;
+
+	do
+	{
+		*--end = '0' + low % 10;
+		low /= 10;
+	} while (low);
+
+	return end;
+}
+
+// NaN, infinities and zero as fp_convert() writes them, or 0
+static int special_value(const decomposed & value, char * dest)
+{
+	if (unlikely(value.is_nan))
+	{
+		memcpy(dest, "NaN", 3);
+		return 3;
+	} else if (unlikely(value.is_infinite))
+	{
+		dest[0] = '-';
+		memcpy(dest + value.negative, "Inf", 3);
+		return 3 + value.negative;
+	}
+
+	return 0;
+}
+
+int fp_convert_fixed(double d, int decimals, char * dest)
+{
+	if (decimals < 0 || decimals > fp_max_decimals)
+		throw std::out_of_range("fp_convert_fixed: bad number of decimals");
+
+	decomposed value(d);
+
+	if (int n = special_value(value, dest))
+		return n;
+
+	uint128_t q = 0;
+
+	if ( ! value.is_zero && ! scaled_round(value, decimals, q))
+		return snprintf(dest, fp_fixed_length, "%.*f", decimals, d);
+
+	char digits[40];
+	char * end = digits + sizeof digits;
+	char * first = write_backwards(q, end);
+
+	// At least one digit before the point
+	while (end - first < decimals + 1)
+		*--first = '0';
+
+	char * out = dest;
+
+	if (value.negative)
+		*out++ = '-';
+
+	int whole = end - first - decimals;
+	memcpy(out, first, whole);
+	out += whole;
+
+	if (decimals)
+	{
+		*out++ = '.';
+		memcpy(out, first + whole, decimals);
+		out += decimals;
+	}
+
+	return out - dest;
+}
+
+int fp_convert_significant(double d, int digits, char * dest)
+{
+	if (digits < 1 || digits > 17)
+		throw std::out_of_range("fp_convert_significant: bad number of digits");
+
+	decomposed value(d);
+
+	if (int n = special_value(value, dest))
+		return n;
+
+	dest[0] = '-';
+
+	if (unlikely(value.is_zero))
+	{
+		dest[value.negative] = '0';
+		return 1 + value.negative;
+	}
+
+	// 2^bits <= |d| < 2^(bits + 1), so this is floor(log10 |d|) or one less
+	int bits = 63 - int(leading_zeros(value.mantissa)) + value.exp;
+	int e10 = int(std::floor(bits * 0.30102999566398114));
+	int p = digits - 1 - e10;
+
+	uint128_t q;
+	char text[40];
+	char * end = text + sizeof text;
+	char * first;
+
+	if (scaled_round(value, p, q) && (q < tens_128[digits]
+	                                 || scaled_round(value, --p, q)))
+	{
+		// Rounding up to the next power of ten
+		if (q == tens_128[digits])
+		{
+			q /= 10;
+			--p;
+		}
+
+		first = write_backwards(q, end);
+	} else
+	{
+		// d.ddde[+-]x, far outside the range of metrics
+		char printed[40];
+		snprintf(printed, sizeof printed, "%.*e", digits - 1, std::fabs(d));
+
+		char * exponent = strchr(printed, 'e');
+		first = end;
+
+		for (const char * c = exponent - 1; c >= printed; --c)
+			if (*c != '.')
+				*--first = *c;
+
+		p = digits - 1 - atoi(exponent + 1);
+	}
+
+	// Trailing zeros only move the exponent
+	int K = -p;
+
+	while (end - first > 1 && end[-1] == '0')
+	{
+		--end;
+		++K;
+	}
+
+	return value.negative
+		+ emit_digits(first, end - first, dest + value.negative, K, value.negative);
+}
+
+void fp_convert(const double * values, size_t n, std::string & out,
+                const fp_format & format, char separator)
+{
+	// Formatted on the stack, and appended once per block
+	char buffer[16 * 1024];
+	char * p = buffer;
+	const size_t room = format.mode == fp_mode::fixed ? fp_fixed_length + 1 : 32;
+
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (size_t(buffer + sizeof buffer - p) < room)
+		{
+			out.append(buffer, p);
+			p = buffer;
+		}
+
+		if (i)
+			*p++ = separator;
+
+		switch (format.mode)
+		{
+		 case fp_mode::shortest:
+			p += fp_convert(values[i], p);
+			break;
+		 case fp_mode::fixed:
+			p += fp_convert_fixed(values[i], format.precision, p);
+			break;
+		 case fp_mode::significant:
+			p += fp_convert_significant(values[i], format.precision, p);
+			break;
+		}
+	}
+
+	out.append(buffer, p);
+}
+
 } // namespace util
@@ -1,10 +1,48 @@
 #ifndef UTIL_FP_CONVERT_H
 #define UTIL_FP_CONVERT_H 1
 
+#include <cstddef>
+#include <string>
+
 namespace util {
 
+// Shortest text that reads back as d.  Returns the length written; dest
+// needs room for 24 characters.
 int fp_convert(double d, char * dest);
 
+static constexpr int fp_max_decimals = 22;
+
+// Enough for any fp_convert_fixed() result, and the '\0' that it may
+// write after it
+static constexpr size_t fp_fixed_length = 1 + 309 + 1 + fp_max_decimals + 1;
+
+// d rounded to a number of decimal places (0 to fp_max_decimals), as
+// printf's "%.*f" would print it.  NaN and infinities come out as
+// fp_convert() writes them.
+int fp_convert_fixed(double d, int decimals, char * dest);
+
+// d rounded to a number of significant digits (1 to 17), trailing zeros
+// dropped and laid out like fp_convert(); dest needs 24 characters.
+int fp_convert_significant(double d, int digits, char * dest);
+
+enum class fp_mode
+{
+	shortest,
+	fixed,
+	significant,
+};
+
+struct fp_format
+{
+	fp_mode mode = fp_mode::shortest;
+	// Decimal places for fixed, significant digits for significant
+	int precision = 0;
+};
+
+// Appends values[0..n) to out, separated by separator.
+void fp_convert(const double * values, size_t n, std::string & out,
+                const fp_format & format = fp_format(), char separator = ',');
+
 } // namespace util
 
 #endif // UTIL_FP_CONVERT_H
@@ -0,0 +1,221 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTIL_SCAN_X86 1
+#endif
+
+namespace util {
+
+namespace {
+
+size_t count_newlines_scalar(const char * p, const char * pe)
+{
+	size_t n = 0;
+
+	for (; p < pe; ++p)
+		n += *p == '\n';
+
+	return n;
+}
+
+const char * skip_plain_string_scalar(const char * p, const char * pe)
+{
+	while (p < pe && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) < 0x80)
+		++p;
+
+	return p;
+}
+
+const char * skip_unescaped_scalar(const char * p, const char * pe)
+{
+	while (p < pe && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20)
+		++p;
+
+	return p;
+}
+
+#ifdef UTIL_SCAN_X86
+// Compiled for the instruction sets named, whatever the build flags; only
+// called once simd() says the CPU has them.
+
+__attribute__((target("sse2")))
+size_t count_newlines_sse2(const char * p, const char * pe)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	size_t n = 0;
+
+	for (; pe - p >= 16; p += 16)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(c, newline)));
+	}
+
+	return n + count_newlines_scalar(p, pe);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_newlines_avx2(const char * p, const char * pe)
+{
+	const __m256i newline = _mm256_set1_epi8('\n');
+	size_t n = 0;
+
+	for (; pe - p >= 64; p += 64)
+	{
+		__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+		uint64_t found = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, newline)))
+			| uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, newline)))) << 32;
+
+		n += __builtin_popcountll(found);
+	}
+
+	return n + count_newlines_sse2(p, pe);
+}
+
+__attribute__((target("sse2")))
+const char * skip_plain_string_sse2(const char * p, const char * pe)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+
+	for (; pe - p >= 16; p += 16)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(c, quote),
+		                               _mm_cmpeq_epi8(c, backslash));
+
+		// The sign bit is set in bytes from 0x80 up
+		if (unsigned found = _mm_movemask_epi8(_mm_or_si128(special, c)))
+			return p + __builtin_ctz(found);
+	}
+
+	return skip_plain_string_scalar(p, pe);
+}
+
+__attribute__((target("avx2")))
+const char * skip_plain_string_avx2(const char * p, const char * pe)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+
+	for (; pe - p >= 32; p += 32)
+	{
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(c, quote),
+		                                  _mm256_cmpeq_epi8(c, backslash));
+
+		if (unsigned found = _mm256_movemask_epi8(_mm256_or_si256(special, c)))
+			return p + __builtin_ctz(found);
+	}
+
+	return skip_plain_string_sse2(p, pe);
+}
+
+__attribute__((target("sse2")))
+const char * skip_unescaped_sse2(const char * p, const char * pe)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i last_control = _mm_set1_epi8(0x1f);
+
+	for (; pe - p >= 16; p += 16)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)),
+			// Unsigned c <= 0x1f
+			_mm_cmpeq_epi8(_mm_min_epu8(c, last_control), c));
+
+		if (unsigned found = _mm_movemask_epi8(special))
+			return p + __builtin_ctz(found);
+	}
+
+	return skip_unescaped_scalar(p, pe);
+}
+
+__attribute__((target("avx2")))
+const char * skip_unescaped_avx2(const char * p, const char * pe)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i last_control = _mm256_set1_epi8(0x1f);
+
+	for (; pe - p >= 32; p += 32)
+	{
+		__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+		__m256i special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(c, quote),
+			                _mm256_cmpeq_epi8(c, backslash)),
+			_mm256_cmpeq_epi8(_mm256_min_epu8(c, last_control), c));
+
+		if (unsigned found = _mm256_movemask_epi8(special))
+			return p + __builtin_ctz(found);
+	}
+
+	return skip_unescaped_sse2(p, pe);
+}
+#endif
+
+} // namespace
+
+// There are no AVX-512 kernels yet; those machines use the AVX2 ones.
+
+size_t count_newlines(const char * p, const char * pe)
+{
+#ifdef UTIL_SCAN_X86
+	switch (simd())
+	{
+	 case simd_level::avx512:
+	 case simd_level::avx2:
+		return count_newlines_avx2(p, pe);
+	 case simd_level::sse42:
+	 case simd_level::sse2:
+		return count_newlines_sse2(p, pe);
+	 case simd_level::scalar:
+		break;
+	}
+#endif
+
+	return count_newlines_scalar(p, pe);
+}
+
+const char * skip_plain_string(const char * p, const char * pe)
+{
+#ifdef UTIL_SCAN_X86
+	switch (simd())
+	{
+	 case simd_level::avx512:
+	 case simd_level::avx2:
+		return skip_plain_string_avx2(p, pe);
+	 case simd_level::sse42:
+	 case simd_level::sse2:
+		return skip_plain_string_sse2(p, pe);
+	 case simd_level::scalar:
+		break;
+	}
+#endif
+
+	return skip_plain_string_scalar(p, pe);
+}
+
+const char * skip_unescaped(const char * p, const char * pe)
+{
+#ifdef UTIL_SCAN_X86
+	switch (simd())
+	{
+	 case simd_level::avx512:
+	 case simd_level::avx2:
+		return skip_unescaped_avx2(p, pe);
+	 case simd_level::sse42:
+	 case simd_level::sse2:
+		return skip_unescaped_sse2(p, pe);
+	 case simd_level::scalar:
+		break;
+	}
+#endif
+
+	return skip_unescaped_scalar(p, pe);
+}
+
+} // namespace util
@@ -0,0 +1,107 @@
+#ifndef UTIL_SCAN_H
+#define UTIL_SCAN_H 1
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "cpu_features.h"
+
+namespace util {
+
+inline bool is_json_whitespace(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// The first character in [p, pe) that is not JSON whitespace, or pe.
+// Inline and SSE2 only: runs in indented output are mostly short, too
+// short for a call or wider vectors to pay off.
+inline const char * skip_whitespace(const char * p, const char * pe)
+{
+#ifdef __SSE2__
+	// Check the next byte before paying for a vector load
+	if (p != pe && is_json_whitespace(*p) && simd() != simd_level::scalar)
+	{
+		const __m128i space = _mm_set1_epi8(' ');
+		const __m128i newline = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i tab = _mm_set1_epi8('\t');
+
+		while (pe - p >= 16)
+		{
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			__m128i ws = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_cmpeq_epi8(c, newline)),
+				_mm_or_si128(_mm_cmpeq_epi8(c, cr), _mm_cmpeq_epi8(c, tab)));
+
+			unsigned other = ~unsigned(_mm_movemask_epi8(ws)) & 0xffff;
+
+			if (other)
+				return p + __builtin_ctz(other);
+
+			p += 16;
+		}
+	}
+#endif
+
+	while (p < pe && is_json_whitespace(*p))
+		++p;
+
+	return p;
+}
+
+// Number of '\n' in [p, pe)
+size_t count_newlines(const char * p, const char * pe);
+
+// The first '"', '\\' or non-ASCII byte in [p, pe), or pe: where a run of
+// plain characters inside a JSON string ends.
+const char * skip_plain_string(const char * p, const char * pe);
+
+// The first byte in [p, pe) that JSON requires to be escaped ('"', '\\'
+// or a control character), or pe.
+const char * skip_unescaped(const char * p, const char * pe);
+
+// Eight unaligned bytes, first byte lowest
+inline uint64_t load_eight(const char * p)
+{
+	uint64_t v;
+	std::memcpy(&v, p, sizeof v);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+// Whether p[0..8) are all ASCII digits
+inline bool is_eight_digits(const char * p)
+{
+	uint64_t v = load_eight(p);
+
+	// High nibbles must all be 3, and adding 6 must not carry out of the
+	// low nibbles
+	return ((v & 0xf0f0f0f0f0f0f0f0)
+	        | (((v + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) >> 4))
+		== 0x3333333333333333;
+}
+
+// The value of eight ASCII digits, with three multiplies instead of eight
+inline uint32_t parse_eight_digits(const char * p)
+{
+	uint64_t v = load_eight(p) - 0x3030303030303030;
+
+	// Pairs of digits, then groups of four, then all eight
+	v = (v * 10) + (v >> 8);
+	v = (((v & 0x000000ff000000ff) * (100 + (1000000ull << 32)))
+	     + (((v >> 16) & 0x000000ff000000ff) * (1 + (10000ull << 32)))) >> 32;
+
+	return v;
+}
+
+} // namespace util
+
+#endif // UTIL_SCAN_H
@@ -0,0 +1,241 @@
+#include "uring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "error_handling.h"
+
+namespace util {
+
+namespace {
+
+template <typename T>
+T * at_offset(void * base, uint32_t offset)
+{
+	return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+} // anonymous namespace
+
+uring::uring(unsigned entries)
+  : ring_fd()
+  , sq_map(MAP_FAILED)
+  , sq_map_size(0)
+  , cq_map(MAP_FAILED)
+  , cq_map_size(0)
+  , sqes(nullptr)
+  , sqes_size(0)
+  , sq_head(nullptr)
+  , sq_tail(nullptr)
+  , sq_mask(nullptr)
+  , sq_array(nullptr)
+  , cq_head(nullptr)
+  , cq_tail(nullptr)
+  , cq_mask(nullptr)
+  , cqes(nullptr)
+  , sq_entries(0)
+  , to_submit(0)
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+
+	ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+
+	if (ring_fd < 0)
+		throw_errno("io_uring_setup failed");
+
+	sq_entries = params.sq_entries;
+
+	sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_map_size = params.cq_off.cqes
+	            + params.cq_entries * sizeof(io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+	sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE,
+	              MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+
+	if (sq_map == MAP_FAILED)
+		throw_errno("Could not map io_uring submission ring");
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cq_map = sq_map;
+	} else
+	{
+		cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+		              MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+
+		if (cq_map == MAP_FAILED)
+		{
+			munmap(sq_map, sq_map_size);
+			throw_errno("Could not map io_uring completion ring");
+		}
+	}
+
+	sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+	void * p = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+	                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+	if (p == MAP_FAILED)
+	{
+		if (cq_map != sq_map)
+			munmap(cq_map, cq_map_size);
+		munmap(sq_map, sq_map_size);
+		throw_errno("Could not map io_uring submission entries");
+	}
+
+	sqes = static_cast<io_uring_sqe *>(p);
+
+	sq_head = at_offset<unsigned>(sq_map, params.sq_off.head);
+	sq_tail = at_offset<unsigned>(sq_map, params.sq_off.tail);
+	sq_mask = at_offset<unsigned>(sq_map, params.sq_off.ring_mask);
+	sq_array = at_offset<unsigned>(sq_map, params.sq_off.array);
+
+	cq_head = at_offset<unsigned>(cq_map, params.cq_off.head);
+	cq_tail = at_offset<unsigned>(cq_map, params.cq_off.tail);
+	cq_mask = at_offset<unsigned>(cq_map, params.cq_off.ring_mask);
+	cqes = at_offset<io_uring_cqe>(cq_map, params.cq_off.cqes);
+}
+
+uring::~uring()
+{
+	munmap(sqes, sqes_size);
+
+	if (cq_map != sq_map)
+		munmap(cq_map, cq_map_size);
+
+	munmap(sq_map, sq_map_size);
+}
+
+io_uring_sqe * uring::get_sqe()
+{
+	unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *sq_tail;
+
+	if (tail - head >= sq_entries)
+	{
+		submit();
+		head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	}
+
+	unsigned index = tail & *sq_mask;
+	io_uring_sqe * sqe = &sqes[index];
+
+	std::memset(sqe, 0, sizeof(*sqe));
+	sq_array[index] = index;
+
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++to_submit;
+
+	return sqe;
+}
+
+void uring::submit(unsigned wait_nr)
+{
+	unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+
+	while (to_submit > 0 || wait_nr > 0)
+	{
+		int rc = syscall(__NR_io_uring_enter, static_cast<int>(ring_fd),
+		                 to_submit, wait_nr, flags, nullptr, 0);
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			throw_errno("io_uring_enter failed");
+		}
+
+		to_submit -= std::min<unsigned>(rc, to_submit);
+
+		// The completions were waited for along with the submission
+		wait_nr = 0;
+	}
+}
+
+bool uring::next_completion(io_uring_cqe & cqe)
+{
+	unsigned head = *cq_head;
+
+	if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	cqe = cqes[head & *cq_mask];
+	__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void uring::prep_openat(int dirfd, const char * path, int flags,
+                        uint64_t user_data)
+{
+	io_uring_sqe * sqe = get_sqe();
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = dirfd;
+	sqe->addr = reinterpret_cast<uintptr_t>(path);
+	sqe->open_flags = flags;
+	sqe->user_data = user_data;
+}
+
+void uring::prep_statx(int dirfd, const char * path, unsigned mask,
+                       struct statx * buffer, uint64_t user_data)
+{
+	io_uring_sqe * sqe = get_sqe();
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = dirfd;
+	sqe->addr = reinterpret_cast<uintptr_t>(path);
+	sqe->len = mask;
+	sqe->off = reinterpret_cast<uintptr_t>(buffer);
+	sqe->user_data = user_data;
+}
+
+void uring::prep_read(int fd, void * buffer, unsigned len, uint64_t offset,
+                      uint64_t user_data)
+{
+	io_uring_sqe * sqe = get_sqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uintptr_t>(buffer);
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+}
+
+void uring::prep_close(int fd, uint64_t user_data)
+{
+	io_uring_sqe * sqe = get_sqe();
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+}
+
+bool uring::supports(unsigned opcode) const
+{
+	// The kernel fills in one entry per opcode it knows of, up to the
+	// number given; the buffer has to start out zeroed.
+	static constexpr unsigned max_ops = 256;
+	std::vector<char> buffer(sizeof(io_uring_probe)
+	                         + max_ops * sizeof(io_uring_probe_op));
+	auto probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+
+	if (syscall(__NR_io_uring_register, static_cast<int>(ring_fd),
+	            IORING_REGISTER_PROBE, probe, max_ops) < 0)
+		return false;
+
+	return opcode <= probe->last_op
+	    && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+} // namespace util
@@ -0,0 +1,80 @@
+#ifndef UTIL_URING_H
+#define UTIL_URING_H 1
+
+#include <linux/io_uring.h>
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "file_descriptor.h"
+
+namespace util {
+
+// Minimal io_uring submission/completion ring talking to the kernel
+// directly, so there is no dependency on liburing.  Not thread safe; one
+// thread owns the ring.  The constructor throws std::system_error when the
+// kernel (or a seccomp policy) does not allow io_uring.
+class uring
+{
+ public:
+	explicit uring(unsigned entries);
+
+	uring(const uring &) = delete;
+
+	uring & operator = (const uring &) = delete;
+
+	~uring();
+
+	// Returns a zeroed submission entry.  If the submission queue is full,
+	// the queued entries are handed to the kernel first.
+	io_uring_sqe * get_sqe();
+
+	// Submits everything queued, then blocks until at least wait_nr
+	// completions are available.
+	void submit(unsigned wait_nr = 0);
+
+	// Copies out the next completion, if any.
+	bool next_completion(io_uring_cqe & cqe);
+
+	void prep_openat(int dirfd, const char * path, int flags,
+	                 uint64_t user_data);
+
+	void prep_statx(int dirfd, const char * path, unsigned mask,
+	                struct statx * buffer, uint64_t user_data);
+
+	void prep_read(int fd, void * buffer, unsigned len, uint64_t offset,
+	               uint64_t user_data);
+
+	void prep_close(int fd, uint64_t user_data);
+
+	// Whether the kernel implements opcode (an IORING_OP_* value).
+	// Kernels before 5.6 can't be asked and are taken to implement none.
+	bool supports(unsigned opcode) const;
+
+ private:
+	file_descriptor ring_fd;
+
+	void * sq_map;
+	size_t sq_map_size;
+	void * cq_map;
+	size_t cq_map_size;
+	io_uring_sqe * sqes;
+	size_t sqes_size;
+
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	io_uring_cqe * cqes;
+
+	unsigned sq_entries;
+	unsigned to_submit;
+};
+
+} // namespace util
+
+#endif // UTIL_URING_H
@@ -0,0 +1,46 @@
+#ifndef UTIL_UTF8_H
+#define UTIL_UTF8_H 1
+
+#include <stdexcept>
+#include <string>
+
+namespace util {
+
+inline void to_utf8(char32_t codepoint, std::string & destination)
+{
+	if (codepoint < 0x80)
+	{
+		destination.push_back(codepoint);
+	} else if (codepoint < 0x800)
+	{
+		destination.push_back( 0xc0 | ( (codepoint >>  6) & 0x1f ) );
+		destination.push_back( 0x80 | ( (codepoint >>  0) & 0x3f ) );
+	} else if (codepoint < 0x10000)
+	{
+		destination.push_back( 0xe0 | ( (codepoint >> 12) & 0x0f ) );
+		destination.push_back( 0x80 | ( (codepoint >>  6) & 0x3f ) );
+		destination.push_back( 0x80 | ( (codepoint >>  0) & 0x3f ) );
+	} else if (codepoint < 0x110000)
+	{
+		destination.push_back( 0xf0 | ( (codepoint >> 18) & 0x07 ) );
+		destination.push_back( 0x80 | ( (codepoint >> 12) & 0x3f ) );
+		destination.push_back( 0x80 | ( (codepoint >>  6) & 0x3f ) );
+		destination.push_back( 0x80 | ( (codepoint >>  0) & 0x3f ) );
+	} else
+		throw std::runtime_error("unicode code point is too large");
+}
+
+inline std::string to_utf8(const std::u32string & source)
+{
+	std::string rc;
+	rc.reserve(source.size());
+
+	for (auto c : source)
+		to_utf8(c, rc);
+
+	return rc;
+}
+
+} // namespace util
+
+#endif // UTIL_UTF8_H